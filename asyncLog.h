@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "eventLoop.h"
+#include "spscRing.h"
+
+// One log call: an event id, when it happened and up to two numbers and a
+// short string. Formatting is left to the logger thread.
+struct LogRecord {
+    int64_t timestamp;
+    int64_t args[2];
+    uint32_t event;
+    char text[20];
+};
+
+// printf format for an event. With `text` set the record's string is passed
+// first, then the two numbers; extra arguments are ignored by printf.
+struct LogFormat {
+    const char* format;
+    bool text;
+};
+
+// Hot paths call log(), which copies a LogRecord into the ring of the
+// calling thread: no locks, no syscalls, no formatting, no allocation. Each
+// thread that logs takes a ring with attachThread() when it starts, before
+// it is on a hot path; a detached thread's ring goes to the next thread to
+// attach. Calls from a thread without a ring are dropped and counted, as
+// are records that find their ring full. A background thread drains every
+// ring each `flush_interval`, orders the batch by time, formats it and
+// writes it with one fwrite per sink.
+class AsyncLogger {
+public:
+    static constexpr size_t RING_RECORDS = 4096;
+    static constexpr size_t MAX_THREADS = 8;
+
+    AsyncLogger(const LogFormat* formats, size_t count, FILE* out = stdout)
+        : formats(formats), format_count(count), out(out) {}
+
+    ~AsyncLogger() {
+        stop();
+        if (file != nullptr) fclose(file);
+    }
+
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+    // Also appends every message, prefixed with its monotonic timestamp, to
+    // `path`.
+    bool openFile(const char* path) {
+        file = fopen(path, "a");
+        return file != nullptr;
+    }
+
+    // Gives the calling thread a ring, reusing a detached one before
+    // allocating. False when MAX_THREADS threads already hold one.
+    bool attachThread() {
+        std::lock_guard<std::mutex> lock(slots_mutex);
+        size_t used = slots_used.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < used; ++i) {
+            if (slots[i].owner.load(std::memory_order_relaxed) == threadToken()) return true;
+        }
+        for (size_t i = 0; i < used; ++i) {
+            if (slots[i].owner.load(std::memory_order_relaxed) == nullptr) {
+                slots[i].owner.store(threadToken(), std::memory_order_release);
+                return true;
+            }
+        }
+        if (used == MAX_THREADS) return false;
+        slots[used].ring.reset(new Ring());
+        slots[used].owner.store(threadToken(), std::memory_order_relaxed);
+        slots_used.store(used + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Hands the calling thread's ring back; what it logged is still written.
+    void detachThread() {
+        std::lock_guard<std::mutex> lock(slots_mutex);
+        Slot* slot = find();
+        if (slot != nullptr) slot->owner.store(nullptr, std::memory_order_release);
+    }
+
+    void start(std::chrono::nanoseconds flush_interval = std::chrono::milliseconds(10)) {
+        if (writer.joinable()) return;
+        running = true;
+        writer = std::thread([this, flush_interval] {
+            while (running.load(std::memory_order_acquire)) {
+                loop.waitUntil(EventLoop::now() + flush_interval);
+                drain();
+            }
+            drain();
+        });
+    }
+
+    // Writes out everything logged so far and stops the logger thread.
+    void stop() {
+        if (!writer.joinable()) return;
+        running.store(false, std::memory_order_release);
+        loop.wake();
+        writer.join();
+    }
+
+    void log(uint32_t event, int64_t a = 0, int64_t b = 0) {
+        LogRecord record;
+        record.timestamp = EventLoop::now().count();
+        record.event = event;
+        record.args[0] = a;
+        record.args[1] = b;
+        record.text[0] = '\0';
+        push(record);
+    }
+
+    void log(uint32_t event, const char* text, int64_t a = 0, int64_t b = 0) {
+        LogRecord record;
+        record.timestamp = EventLoop::now().count();
+        record.event = event;
+        record.args[0] = a;
+        record.args[1] = b;
+        std::strncpy(record.text, text, sizeof(record.text) - 1);
+        record.text[sizeof(record.text) - 1] = '\0';
+        push(record);
+    }
+
+    uint64_t dropped() const {
+        uint64_t total = unattached.load(std::memory_order_relaxed);
+        size_t used = slots_used.load(std::memory_order_acquire);
+        for (size_t i = 0; i < used; ++i) total += slots[i].ring->droppedCount();
+        return total;
+    }
+
+    uint64_t written() const {
+        return records_written.load(std::memory_order_relaxed);
+    }
+
+private:
+    using Ring = SpscRing<LogRecord, RING_RECORDS>;
+
+    // A ring and the thread now producing into it. Rings are only ever
+    // added, so the writer thread reads them without the lock.
+    struct Slot {
+        std::atomic<const void*> owner{nullptr};
+        std::unique_ptr<Ring> ring;
+    };
+
+    // Unique among live threads, and the same in every logger.
+    static const void* threadToken() {
+        thread_local char token;
+        return &token;
+    }
+
+    Slot* find() {
+        const void* token = threadToken();
+        size_t used = slots_used.load(std::memory_order_acquire);
+        for (size_t i = 0; i < used; ++i) {
+            if (slots[i].owner.load(std::memory_order_acquire) == token) return &slots[i];
+        }
+        return nullptr;
+    }
+
+    void push(const LogRecord& record) {
+        Slot* slot = find();
+        if (slot == nullptr) {
+            unattached.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        slot->ring->push(record);
+    }
+
+    void drain() {
+        batch.clear();
+        uint64_t lost = unattached.load(std::memory_order_relaxed);
+        size_t used = slots_used.load(std::memory_order_acquire);
+        LogRecord record;
+        for (size_t i = 0; i < used; ++i) {
+            while (slots[i].ring->pop(record)) batch.push_back(record);
+            lost += slots[i].ring->droppedCount();
+        }
+        std::stable_sort(batch.begin(), batch.end(), [](const LogRecord& a, const LogRecord& b) {
+            return a.timestamp < b.timestamp;
+        });
+
+        text.clear();
+        stamped.clear();
+        for (const LogRecord& record : batch) format(record);
+        if (lost > reported_lost) {
+            char line[96];
+            snprintf(line, sizeof(line), "Изгубени записи в журнала: %llu\n",
+                     (unsigned long long)(lost - reported_lost));
+            text += line;
+            stamped += line;
+            reported_lost = lost;
+        }
+
+        if (!text.empty()) {
+            fwrite(text.data(), 1, text.size(), out);
+            fflush(out);
+        }
+        if (file != nullptr && !stamped.empty()) {
+            fwrite(stamped.data(), 1, stamped.size(), file);
+            fflush(file);
+        }
+        records_written.fetch_add(batch.size(), std::memory_order_relaxed);
+    }
+
+    void format(const LogRecord& record) {
+        char line[256];
+        if (record.event >= format_count) {
+            snprintf(line, sizeof(line), "Непознат запис %u\n", record.event);
+        } else if (formats[record.event].text) {
+            snprintf(line, sizeof(line), formats[record.event].format, record.text,
+                     (long long)record.args[0], (long long)record.args[1]);
+        } else {
+            snprintf(line, sizeof(line), formats[record.event].format,
+                     (long long)record.args[0], (long long)record.args[1]);
+        }
+        text += line;
+        if (file != nullptr) {
+            char stamp[32];
+            snprintf(stamp, sizeof(stamp), "%lld.%06lld ", (long long)(record.timestamp / 1000000000),
+                     (long long)(record.timestamp % 1000000000 / 1000));
+            stamped += stamp;
+            stamped += line;
+        }
+    }
+
+    const LogFormat* formats;
+    size_t format_count;
+    FILE* out;
+    FILE* file = nullptr;
+
+    std::mutex slots_mutex;
+    Slot slots[MAX_THREADS];
+    std::atomic<size_t> slots_used{0};
+    std::atomic<uint64_t> unattached{0};
+
+    EventLoop loop;
+    std::thread writer;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> records_written{0};
+    std::vector<LogRecord> batch;
+    std::string text;
+    std::string stamped;
+    uint64_t reported_lost = 0;
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// One benchmarked operation: wall time per call (median over batches, and
+// the spread between their quartiles) and what it put on the mock hardware
+// per call.
+struct BenchResult {
+    std::string name;
+    double ns_per_op = 0;
+    double ns_spread = 0;
+    double i2c_syscalls = 0;
+    double i2c_messages = 0;
+    double i2c_bytes = 0;
+    double gpio_writes = 0;
+};
+
+inline bool writeBenchJson(const std::vector<BenchResult>& results, const char* path) {
+    FILE* out = std::strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (out == nullptr) return false;
+    fprintf(out, "{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        fprintf(out,
+                "    {\"name\": \"%s\", \"ns_per_op\": %.1f, \"ns_spread\": %.1f, \"i2c_syscalls\": %.3f, "
+                "\"i2c_messages\": %.3f, \"i2c_bytes\": %.3f, \"gpio_writes\": %.3f}%s\n",
+                r.name.c_str(), r.ns_per_op, r.ns_spread, r.i2c_syscalls, r.i2c_messages, r.i2c_bytes, r.gpio_writes,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return out == stdout || fclose(out) == 0;
+}
+
+// Reads back what writeBenchJson() wrote; not a general JSON parser.
+inline bool readBenchJson(const char* path, std::vector<BenchResult>& results) {
+    FILE* in = fopen(path, "r");
+    if (in == nullptr) return false;
+    std::string text;
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) text.append(buffer, n);
+    fclose(in);
+
+    auto field = [&text](size_t from, size_t to, const char* key) {
+        size_t at = text.find(key, from);
+        return at < to ? std::strtod(text.c_str() + at + std::strlen(key), nullptr) : 0.0;
+    };
+    size_t at = 0;
+    while ((at = text.find("\"name\": \"", at)) != std::string::npos) {
+        size_t begin = at + 9;
+        size_t end = text.find('"', begin);
+        size_t close = text.find('}', end);
+        if (end == std::string::npos || close == std::string::npos) return false;
+        BenchResult r;
+        r.name = text.substr(begin, end - begin);
+        r.ns_per_op = field(end, close, "\"ns_per_op\": ");
+        r.ns_spread = field(end, close, "\"ns_spread\": ");
+        r.i2c_syscalls = field(end, close, "\"i2c_syscalls\": ");
+        r.i2c_messages = field(end, close, "\"i2c_messages\": ");
+        r.i2c_bytes = field(end, close, "\"i2c_bytes\": ");
+        r.gpio_writes = field(end, close, "\"gpio_writes\": ");
+        results.push_back(r);
+        at = close;
+    }
+    return true;
+}
+
+// Below this a difference in ns per operation is never taken for a
+// regression, whatever the spreads say.
+constexpr double BENCH_NS_NOISE = 20;
+
+// Prints every benchmark next to its baseline and returns false if time or
+// any hardware count per operation grew by more than `threshold_percent`.
+// Time has to grow by more than the two runs' spreads together as well.
+inline bool compareBench(const std::vector<BenchResult>& current, const std::vector<BenchResult>& baseline,
+                         double threshold_percent) {
+    bool ok = true;
+    auto check = [&](const std::string& name, const char* what, double now, double before, double noise) {
+        bool worse = now > before * (1 + threshold_percent / 100) && now - before > noise;
+        printf("  %-22s %-13s %12.3f -> %12.3f %s\n", name.c_str(), what, before, now, worse ? "РЕГРЕСИЯ" : "");
+        if (worse) ok = false;
+    };
+    for (const BenchResult& r : current) {
+        const BenchResult* base = nullptr;
+        for (const BenchResult& b : baseline) {
+            if (b.name == r.name) base = &b;
+        }
+        if (base == nullptr) {
+            printf("  %-22s няма базова стойност\n", r.name.c_str());
+            continue;
+        }
+        check(r.name, "ns_per_op", r.ns_per_op, base->ns_per_op,
+              std::max(BENCH_NS_NOISE, r.ns_spread + base->ns_spread));
+        check(r.name, "i2c_syscalls", r.i2c_syscalls, base->i2c_syscalls, 1e-9);
+        check(r.name, "i2c_messages", r.i2c_messages, base->i2c_messages, 1e-9);
+        check(r.name, "i2c_bytes", r.i2c_bytes, base->i2c_bytes, 1e-9);
+        check(r.name, "gpio_writes", r.gpio_writes, base->gpio_writes, 1e-9);
+    }
+    return ok;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+struct ButtonEdge {
+    std::chrono::nanoseconds timestamp;
+    bool rising;
+};
+
+// Runs on the consumer side: a falling edge counts as a press only if the
+// last accepted press is at least `lockout` older, so contact bounce never
+// reaches the controller.
+class Debouncer {
+public:
+    explicit Debouncer(std::chrono::nanoseconds lockout) : lockout(lockout) {}
+
+    bool accept(const ButtonEdge& edge) {
+        if (edge.rising) return false;
+        if (seen && edge.timestamp - last_press < lockout) {
+            ++rejected;
+            return false;
+        }
+        seen = true;
+        last_press = edge.timestamp;
+        ++accepted;
+        return true;
+    }
+
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+
+private:
+    std::chrono::nanoseconds lockout;
+    std::chrono::nanoseconds last_press{0};
+    bool seen = false;
+};
+
+// Edges from the interrupt side to the consumer's Debouncer, unfiltered.
+// push() never blocks or allocates; on a full ring it discards the oldest
+// edge rather than the newest, so whatever the consumer missed while it
+// slept, the last press is still there to be debounced. A slot is one
+// atomic word (timestamp << 1 | rising) because the producer may reuse the
+// slot the consumer is reading: the consumer claims a slot by moving the
+// read index on and rereads when the producer moved it first.
+template <size_t Capacity>
+class EdgeRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    void push(const ButtonEdge& edge) {
+        uint64_t head = write_index.load(std::memory_order_relaxed);
+        uint64_t tail = read_index.load(std::memory_order_acquire);
+        if (head - tail == Capacity &&
+            read_index.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            overwritten.fetch_add(1, std::memory_order_relaxed);
+        }
+        slots[head & (Capacity - 1)].store(uint64_t(edge.timestamp.count()) << 1 | (edge.rising ? 1 : 0),
+                                           std::memory_order_relaxed);
+        write_index.store(head + 1, std::memory_order_release);
+    }
+
+    bool pop(ButtonEdge& edge) {
+        uint64_t tail = read_index.load(std::memory_order_acquire);
+        while (tail != write_index.load(std::memory_order_acquire)) {
+            uint64_t word = slots[tail & (Capacity - 1)].load(std::memory_order_relaxed);
+            if (read_index.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel,
+                                                 std::memory_order_acquire)) {
+                edge.timestamp = std::chrono::nanoseconds(int64_t(word) >> 1);
+                edge.rising = (word & 1) != 0;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Consumer side: nothing left to pop right now.
+    bool empty() const {
+        return read_index.load(std::memory_order_relaxed) == write_index.load(std::memory_order_acquire);
+    }
+
+    // Oldest edges given up for newer ones.
+    uint64_t droppedCount() const {
+        return overwritten.load(std::memory_order_relaxed);
+    }
+
+private:
+    alignas(64) std::atomic<uint64_t> write_index{0};
+    alignas(64) std::atomic<uint64_t> read_index{0};
+    alignas(64) std::atomic<uint64_t> overwritten{0};
+    std::atomic<uint64_t> slots[Capacity];
+};
+
+// Button line requested from the GPIO character device with falling-edge
+// detection; every edge comes with the kernel's CLOCK_MONOTONIC timestamp
+// taken in the interrupt handler.
+class GpioEdgeSource {
+public:
+    ~GpioEdgeSource() {
+        if (line_fd >= 0) close(line_fd);
+    }
+
+    bool open(int pin, const char* chip = "/dev/gpiochip0") {
+        int chip_fd = ::open(chip, O_RDWR | O_CLOEXEC);
+        if (chip_fd < 0) return false;
+
+        gpio_v2_line_request request;
+        std::memset(&request, 0, sizeof(request));
+        std::strncpy(request.consumer, "traffic-button", sizeof(request.consumer) - 1);
+        request.offsets[0] = pin;
+        request.num_lines = 1;
+        request.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING |
+                               GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+
+        int result = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &request);
+        close(chip_fd);
+        if (result < 0) return false;
+        line_fd = request.fd;
+        return true;
+    }
+
+    // Blocks until the next edge; false once the line is gone.
+    bool read(ButtonEdge& edge) {
+        gpio_v2_line_event event;
+        if (::read(line_fd, &event, sizeof(event)) != sizeof(event)) return false;
+        edge.timestamp = std::chrono::nanoseconds(event.timestamp_ns);
+        edge.rising = event.id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+        return true;
+    }
+
+private:
+    int line_fd = -1;
+};
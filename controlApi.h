@@ -0,0 +1,437 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "eventLoop.h"
+#include "tripleBuffer.h"
+
+// Wire format, host byte order (the Pi and every client we have are little
+// endian). A Unix stream carries back-to-back frames; a UDP datagram carries
+// up to 16 whole frames and gets all their replies in one datagram. A UDP
+// subscription is a lease of ControlServer::UDP_LEASE that the client renews
+// by subscribing again; a stream subscriber stays until it disconnects or
+// stops reading.
+enum ControlOp : uint8_t {
+    CONTROL_QUERY = 1,
+    CONTROL_TRIGGER = 2,
+    CONTROL_SUBSCRIBE = 3,
+    CONTROL_UNSUBSCRIBE = 4,
+    CONTROL_STATE = 0x80,
+};
+
+enum ControlStatus : uint8_t {
+    CONTROL_OK = 0,
+    CONTROL_BAD_FRAME = 1,
+    CONTROL_FULL = 2,
+};
+
+constexpr uint16_t CONTROL_MAGIC = 0x544C;
+constexpr uint8_t CONTROL_VERSION = 1;
+
+struct ControlRequest {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t op;
+    uint32_t id;
+};
+
+// Flags in ControlReply::flags.
+constexpr uint8_t CONTROL_LINK_UP = 0x1;
+constexpr uint8_t CONTROL_SEQUENCE_RUNNING = 0x2;
+constexpr uint8_t CONTROL_REQUEST_PENDING = 0x4;
+
+// The answer to every request and the frame pushed to subscribers (op
+// CONTROL_STATE, id 0). `phase` is -1 at rest, `seconds` -1 outside a
+// countdown; `state_version` counts state changes and `timestamp` is when
+// the last one happened (CLOCK_MONOTONIC ns).
+struct ControlReply {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t op;
+    uint32_t id;
+    uint8_t status;
+    int8_t phase;
+    int8_t seconds;
+    uint8_t flags;
+    uint32_t state_version;
+    uint64_t cycles;
+    int64_t timestamp;
+};
+
+static_assert(sizeof(ControlRequest) == 8, "request frame layout");
+static_assert(sizeof(ControlReply) == 32, "reply frame layout");
+
+// What the controller publishes on every change.
+struct ControlState {
+    int8_t phase;
+    int8_t seconds;
+    bool link;
+    bool running;
+    uint64_t cycles;
+    int64_t timestamp;
+};
+
+// One epoll thread serving the Unix socket and UDP port. The controller
+// publishes state through a triple buffer and an eventfd, as it does for the
+// display, so neither side ever waits on the other; queries are answered
+// from the newest published state plus the pending-request flag read
+// through `pending`. All buffers are fixed: nothing is allocated per request.
+class ControlServer {
+public:
+    static constexpr int MAX_CLIENTS = 32;
+    static constexpr int MAX_UDP_SUBSCRIBERS = 64;
+    static constexpr int BATCH = 32;
+    static constexpr int BUFFER = 4096;
+    static constexpr int STREAM_FRAMES = BUFFER / int(sizeof(ControlRequest));
+    static constexpr int DATAGRAM_FRAMES = 16;
+    static constexpr std::chrono::nanoseconds UDP_LEASE = std::chrono::seconds(30);
+
+    ControlServer(void (*trigger)(), bool (*pending)()) : trigger(trigger), pending(pending) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        add(wake_fd, WAKE_TAG);
+        for (Client& client : clients) client.fd = -1;
+    }
+
+    ~ControlServer() {
+        for (Client& client : clients) {
+            if (client.fd >= 0) close(client.fd);
+        }
+        if (unix_fd >= 0) {
+            close(unix_fd);
+            unlink(socket_path.c_str());
+        }
+        if (udp_fd >= 0) close(udp_fd);
+        close(wake_fd);
+        close(epoll_fd);
+    }
+
+    bool listenUnix(const char* path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path) >= int(sizeof(addr.sun_path))) return false;
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd < 0) return false;
+        unlink(path);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+            close(fd);
+            return false;
+        }
+        unix_fd = fd;
+        socket_path = path;
+        add(unix_fd, UNIX_TAG);
+        return true;
+    }
+
+    // Port 0 picks a free one; udpPort() tells which.
+    bool listenUdp(uint16_t port, const char* address = "127.0.0.1") {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) return false;
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd < 0) return false;
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            close(fd);
+            return false;
+        }
+        udp_fd = fd;
+        add(udp_fd, UDP_TAG);
+        return true;
+    }
+
+    uint16_t udpPort() const {
+        sockaddr_in addr{};
+        socklen_t length = sizeof(addr);
+        if (udp_fd < 0 || getsockname(udp_fd, reinterpret_cast<sockaddr*>(&addr), &length) < 0) return 0;
+        return ntohs(addr.sin_port);
+    }
+
+    // Controller side: never blocks.
+    void publish(const ControlState& state) {
+        states.publish(state);
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    // Blocks until stop(). Safe to call stop() from a signal handler.
+    void run() {
+        epoll_event events[BATCH];
+        while (!stopping) {
+            int count = epoll_wait(epoll_fd, events, BATCH, -1);
+            if (count < 0 && errno != EINTR) return;
+            for (int i = 0; i < count; ++i) {
+                uint64_t tag = events[i].data.u64;
+                if (tag == WAKE_TAG) {
+                    uint64_t value;
+                    ssize_t n = read(wake_fd, &value, sizeof(value));
+                    (void)n;
+                    if (states.take(current)) {
+                        state_version += 1;
+                        pushState();
+                    }
+                } else if (tag == UNIX_TAG) {
+                    acceptClients();
+                } else if (tag == UDP_TAG) {
+                    serveUdp();
+                } else {
+                    serveClient(clients[tag - CLIENT_TAG]);
+                }
+            }
+        }
+    }
+
+    void stop() {
+        stopping = true;
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    uint64_t requests = 0;
+    uint64_t batches = 0;
+    uint64_t pushed = 0;
+
+private:
+    static constexpr uint64_t WAKE_TAG = 0;
+    static constexpr uint64_t UNIX_TAG = 1;
+    static constexpr uint64_t UDP_TAG = 2;
+    static constexpr uint64_t CLIENT_TAG = 3;
+
+    struct Client {
+        int fd;
+        int filled;
+        bool subscribed;
+        uint8_t in[BUFFER];
+    };
+
+    void add(int fd, uint64_t tag) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = tag;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    void fill(ControlReply& reply, uint8_t op, uint32_t id, uint8_t status) {
+        reply.magic = CONTROL_MAGIC;
+        reply.version = CONTROL_VERSION;
+        reply.op = op;
+        reply.id = id;
+        reply.status = status;
+        reply.phase = current.phase;
+        reply.seconds = current.seconds;
+        reply.flags = uint8_t((current.link ? CONTROL_LINK_UP : 0) | (current.running ? CONTROL_SEQUENCE_RUNNING : 0) |
+                              (pending() ? CONTROL_REQUEST_PENDING : 0));
+        reply.state_version = state_version;
+        reply.cycles = current.cycles;
+        reply.timestamp = current.timestamp;
+    }
+
+    // Answers every whole frame in `in` into `out`; returns the reply count.
+    // `subscribe` is told about (un)subscriptions.
+    template <class Subscribe>
+    int handleFrames(const uint8_t* in, int length, ControlReply* out, int capacity, Subscribe subscribe) {
+        int replies = 0;
+        for (int at = 0; at + int(sizeof(ControlRequest)) <= length && replies < capacity;
+             at += sizeof(ControlRequest)) {
+            ControlRequest request;
+            std::memcpy(&request, in + at, sizeof(request));
+            requests += 1;
+            uint8_t status = CONTROL_OK;
+            if (request.magic != CONTROL_MAGIC || request.version != CONTROL_VERSION) {
+                status = CONTROL_BAD_FRAME;
+            } else if (request.op == CONTROL_TRIGGER) {
+                trigger();
+            } else if (request.op == CONTROL_SUBSCRIBE || request.op == CONTROL_UNSUBSCRIBE) {
+                if (!subscribe(request.op == CONTROL_SUBSCRIBE)) status = CONTROL_FULL;
+            } else if (request.op != CONTROL_QUERY) {
+                status = CONTROL_BAD_FRAME;
+            }
+            fill(out[replies++], request.op, request.id, status);
+        }
+        batches += 1;
+        return replies;
+    }
+
+    void acceptClients() {
+        while (true) {
+            int fd = accept4(unix_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (fd < 0) return;
+            int slot = 0;
+            while (slot < MAX_CLIENTS && clients[slot].fd >= 0) ++slot;
+            if (slot == MAX_CLIENTS) {
+                close(fd);
+                continue;
+            }
+            clients[slot].fd = fd;
+            clients[slot].filled = 0;
+            clients[slot].subscribed = false;
+            add(fd, CLIENT_TAG + slot);
+        }
+    }
+
+    void drop(Client& client) {
+        close(client.fd);
+        client.fd = -1;
+    }
+
+    void serveClient(Client& client) {
+        if (client.fd < 0) return;
+        ssize_t n = recv(client.fd, client.in + client.filled, BUFFER - client.filled, 0);
+        if (n <= 0) {
+            if (n == 0 || (errno != EAGAIN && errno != EINTR)) drop(client);
+            return;
+        }
+        client.filled += int(n);
+        int frames = client.filled / int(sizeof(ControlRequest));
+        int replies = handleFrames(client.in, frames * int(sizeof(ControlRequest)), replies_out, STREAM_FRAMES,
+                                   [&client](bool on) {
+                                       client.subscribed = on;
+                                       return true;
+                                   });
+        int used = frames * int(sizeof(ControlRequest));
+        std::memmove(client.in, client.in + used, client.filled - used);
+        client.filled -= used;
+        // A client that does not read its replies loses the connection
+        // rather than the stream losing frame alignment.
+        ssize_t expected = ssize_t(replies * sizeof(ControlReply));
+        if (replies > 0 && send(client.fd, replies_out, expected, MSG_NOSIGNAL) != expected) drop(client);
+    }
+
+    // Up to BATCH datagrams in with one recvmmsg, all replies out with one
+    // sendmmsg.
+    void serveUdp() {
+        while (true) {
+            mmsghdr messages[BATCH];
+            std::memset(messages, 0, sizeof(messages));
+            for (int i = 0; i < BATCH; ++i) {
+                udp_in_iov[i] = {udp_in[i], sizeof(udp_in[i])};
+                messages[i].msg_hdr.msg_iov = &udp_in_iov[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+                messages[i].msg_hdr.msg_name = &udp_peers[i];
+                messages[i].msg_hdr.msg_namelen = sizeof(udp_peers[i]);
+            }
+            int count = recvmmsg(udp_fd, messages, BATCH, MSG_DONTWAIT, nullptr);
+            if (count <= 0) return;
+
+            mmsghdr out[BATCH];
+            std::memset(out, 0, sizeof(out));
+            int sending = 0;
+            for (int i = 0; i < count; ++i) {
+                const sockaddr_in& peer = udp_peers[i];
+                int replies = handleFrames(udp_in[i], int(messages[i].msg_len), udp_out[i], DATAGRAM_FRAMES,
+                                           [this, &peer](bool on) { return subscribeUdp(peer, on); });
+                if (replies == 0) continue;
+                udp_out_iov[sending] = {udp_out[i], replies * sizeof(ControlReply)};
+                out[sending].msg_hdr.msg_iov = &udp_out_iov[sending];
+                out[sending].msg_hdr.msg_iovlen = 1;
+                out[sending].msg_hdr.msg_name = &udp_peers[i];
+                out[sending].msg_hdr.msg_namelen = sizeof(udp_peers[i]);
+                ++sending;
+            }
+            if (sending > 0) sendmmsg(udp_fd, out, sending, MSG_DONTWAIT);
+            if (count < BATCH) return;
+        }
+    }
+
+    // Subscribing again renews the lease; a lapsed one frees its slot.
+    bool subscribeUdp(const sockaddr_in& peer, bool on) {
+        auto now = EventLoop::now();
+        int free_slot = -1;
+        for (int i = 0; i < MAX_UDP_SUBSCRIBERS; ++i) {
+            if (udp_subscribed[i] && udp_expires[i] <= now) udp_subscribed[i] = false;
+            if (udp_subscribed[i] && udp_subscribers[i].sin_port == peer.sin_port &&
+                udp_subscribers[i].sin_addr.s_addr == peer.sin_addr.s_addr) {
+                udp_subscribed[i] = on;
+                udp_expires[i] = now + UDP_LEASE;
+                return true;
+            }
+            if (!udp_subscribed[i] && free_slot < 0) free_slot = i;
+        }
+        if (!on) return true;
+        if (free_slot < 0) return false;
+        udp_subscribers[free_slot] = peer;
+        udp_subscribed[free_slot] = true;
+        udp_expires[free_slot] = now + UDP_LEASE;
+        return true;
+    }
+
+    void pushState() {
+        ControlReply frame;
+        fill(frame, CONTROL_STATE, 0, CONTROL_OK);
+        // A subscriber whose socket buffer is full would miss this frame
+        // and carry on with a gap; it is dropped instead, as a client that
+        // does not read its replies is.
+        for (Client& client : clients) {
+            if (client.fd >= 0 && client.subscribed) {
+                if (send(client.fd, &frame, sizeof(frame), MSG_NOSIGNAL | MSG_DONTWAIT) == sizeof(frame)) {
+                    pushed += 1;
+                } else {
+                    drop(client);
+                }
+            }
+        }
+        if (udp_fd < 0) return;
+        mmsghdr out[MAX_UDP_SUBSCRIBERS];
+        iovec iov = {&frame, sizeof(frame)};
+        int sending = 0;
+        auto now = EventLoop::now();
+        for (int i = 0; i < MAX_UDP_SUBSCRIBERS; ++i) {
+            if (udp_subscribed[i] && udp_expires[i] <= now) udp_subscribed[i] = false;
+            if (!udp_subscribed[i]) continue;
+            std::memset(&out[sending], 0, sizeof(out[sending]));
+            out[sending].msg_hdr.msg_iov = &iov;
+            out[sending].msg_hdr.msg_iovlen = 1;
+            out[sending].msg_hdr.msg_name = &udp_subscribers[i];
+            out[sending].msg_hdr.msg_namelen = sizeof(udp_subscribers[i]);
+            ++sending;
+        }
+        // sendmmsg() stops at the first peer it cannot send to; the rest
+        // still get the frame.
+        for (int at = 0; at < sending;) {
+            int sent = sendmmsg(udp_fd, out + at, sending - at, MSG_DONTWAIT);
+            if (sent > 0) pushed += uint64_t(sent);
+            at += (sent > 0 ? sent : 0) + 1;
+        }
+    }
+
+    void (*trigger)();
+    bool (*pending)();
+
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    int unix_fd = -1;
+    int udp_fd = -1;
+    std::string socket_path;
+    std::atomic<bool> stopping{false};
+
+    TripleBuffer<ControlState> states;
+    ControlState current = {-1, -1, true, false, 0, 0};
+    uint32_t state_version = 0;
+
+    Client clients[MAX_CLIENTS];
+    ControlReply replies_out[STREAM_FRAMES];
+
+    uint8_t udp_in[BATCH][DATAGRAM_FRAMES * sizeof(ControlRequest)];
+    iovec udp_in_iov[BATCH];
+    sockaddr_in udp_peers[BATCH];
+    ControlReply udp_out[BATCH][DATAGRAM_FRAMES];
+    iovec udp_out_iov[BATCH];
+    sockaddr_in udp_subscribers[MAX_UDP_SUBSCRIBERS];
+    bool udp_subscribed[MAX_UDP_SUBSCRIBERS] = {};
+    std::chrono::nanoseconds udp_expires[MAX_UDP_SUBSCRIBERS] = {};
+};
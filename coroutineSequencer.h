@@ -0,0 +1,513 @@
+#pragma once
+
+#if __cplusplus < 202002L || !defined(__cpp_impl_coroutine)
+#error "coroutineSequencer.h needs C++20 coroutines (-std=c++20)"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <utility>
+#include <vector>
+#include "eventLoop.h"
+#include "phaseEngine.h"
+#include "trafficPlan.h"
+
+// Pedestrian sequences as C++20 coroutines on one thread. A sequence reads
+// like the blocking one - set the outputs, wait out the phase, count down -
+// but every wait is a co_await on a TimerExecutor, which resumes whichever
+// sequence is due next. Any number of crossings share the thread; a waiting
+// sequence is its frame and nothing else.
+
+// Coroutine frames by size class out of 64 KiB chunks, so starting a
+// sequence does not go to malloc. Frames above the largest class do. Only
+// the executor thread allocates and frees.
+class FramePool {
+public:
+    static constexpr size_t GRANULE = 64;
+    static constexpr size_t CLASSES = 16;
+    static constexpr size_t CHUNK = 64 << 10;
+
+    FramePool() = default;
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    ~FramePool() {
+        for (void* chunk : chunks) ::operator delete(chunk);
+    }
+
+    void* allocate(size_t size) {
+        size_t bytes = size + sizeof(Header);
+        size_t size_class = (bytes + GRANULE - 1) / GRANULE;
+        Header* header;
+        if (size_class > CLASSES) {
+            header = static_cast<Header*>(::operator new(bytes));
+            size_class = 0;
+            oversized += 1;
+        } else {
+            bytes = size_class * GRANULE;
+            if (free_lists[size_class] != nullptr) {
+                header = free_lists[size_class];
+                free_lists[size_class] = header->next;
+            } else {
+                header = carve(bytes);
+            }
+        }
+        header->pool = this;
+        header->size_class = uint32_t(size_class);
+        header->bytes = uint32_t(bytes);
+        in_use += bytes;
+        peak = std::max(peak, in_use);
+        frames += 1;
+        allocations += 1;
+        return header + 1;
+    }
+
+    static void release(void* frame) {
+        Header* header = static_cast<Header*>(frame) - 1;
+        FramePool* pool = header->pool;
+        pool->in_use -= header->bytes;
+        pool->frames -= 1;
+        if (header->size_class == 0) {
+            ::operator delete(header);
+            return;
+        }
+        header->next = pool->free_lists[header->size_class];
+        pool->free_lists[header->size_class] = header;
+    }
+
+    size_t reserved() const {
+        return chunks.size() * CHUNK;
+    }
+
+    size_t in_use = 0;
+    size_t peak = 0;
+    size_t frames = 0;
+    uint64_t allocations = 0;
+    uint64_t oversized = 0;
+
+private:
+    // 16 bytes, so frames keep the alignment operator new would give them.
+    struct alignas(16) Header {
+        union {
+            FramePool* pool;
+            Header* next;
+        };
+        uint32_t size_class;
+        uint32_t bytes;
+    };
+
+    Header* carve(size_t bytes) {
+        if (chunks.empty() || chunk_used + bytes > CHUNK) {
+            chunks.push_back(::operator new(CHUNK));
+            chunk_used = 0;
+        }
+        Header* header = reinterpret_cast<Header*>(static_cast<char*>(chunks.back()) + chunk_used);
+        chunk_used += bytes;
+        return header;
+    }
+
+    Header* free_lists[CLASSES + 1] = {};
+    std::vector<void*> chunks;
+    size_t chunk_used = 0;
+};
+
+// A lazily started coroutine returning nothing. Awaiting one runs it to
+// completion and continues the awaiter by symmetric transfer; destroying a
+// Task destroys the frame and, through it, any Task it is awaiting. The
+// first parameter (the object, for member coroutines) must have frames()
+// returning the FramePool the frame comes from.
+class Task {
+public:
+    struct promise_type {
+        std::coroutine_handle<> continuation;
+
+        template <class Owner, class... Args>
+        static void* operator new(size_t size, Owner& owner, Args&...) {
+            return owner.frames().allocate(size);
+        }
+
+        static void operator delete(void* frame) {
+            FramePool::release(frame);
+        }
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        struct Final {
+            bool await_ready() noexcept {
+                return false;
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> done) noexcept {
+                std::coroutine_handle<> next = done.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        Final final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    ~Task() {
+        if (handle) handle.destroy();
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    void await_resume() noexcept {}
+
+    std::coroutine_handle<promise_type> release() {
+        return std::exchange(handle, nullptr);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Runs spawned Tasks on the thread that calls run(). The only thing a task
+// waits for is a deadline: a binary heap of timers, with the thread asleep
+// on an EventLoop until the earliest, or, in virtual time, the clock
+// jumping straight to it. cancel() destroys a task wherever it is waiting,
+// every frame down to the innermost await; cancelAll() and stop() do the
+// same from any thread or a signal handler.
+class TimerExecutor {
+public:
+    struct TaskId {
+        uint32_t index;
+        uint32_t generation;
+    };
+
+    // `done` is called on the executor thread when a task finishes or is
+    // cancelled, after its frames are gone.
+    using Done = void (*)(void* context, bool cancelled);
+
+    explicit TimerExecutor(bool virtual_time = false) : virtual_time(virtual_time) {}
+
+    TimerExecutor(const TimerExecutor&) = delete;
+    TimerExecutor& operator=(const TimerExecutor&) = delete;
+
+    ~TimerExecutor() {
+        for (size_t i = 0; i < roots.size(); ++i) {
+            if (roots[i].handle) roots[i].handle.destroy();
+        }
+    }
+
+    FramePool& frames() {
+        return pool;
+    }
+
+    std::chrono::nanoseconds now() const {
+        return virtual_time ? clock : EventLoop::now();
+    }
+
+    class Sleep {
+    public:
+        Sleep(TimerExecutor& executor, std::chrono::nanoseconds deadline) : executor(executor), deadline(deadline) {}
+
+        bool await_ready() const {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> waiting) {
+            executor.park(waiting, deadline);
+        }
+
+        void await_resume() const {}
+
+    private:
+        TimerExecutor& executor;
+        std::chrono::nanoseconds deadline;
+    };
+
+    Sleep sleepUntil(std::chrono::nanoseconds deadline) {
+        return Sleep(*this, deadline);
+    }
+
+    // Starts `task` on the next turn of run().
+    TaskId spawn(Task task, Done done = nullptr, void* context = nullptr) {
+        uint32_t index;
+        if (!free_roots.empty()) {
+            index = free_roots.back();
+            free_roots.pop_back();
+        } else {
+            index = uint32_t(roots.size());
+            roots.emplace_back();
+        }
+        Root& root = roots[index];
+        root.handle = task.release();
+        root.done = done;
+        root.context = context;
+        root.cancelled = false;
+        live += 1;
+        TaskId id{index, root.generation};
+        uint32_t previous = current;
+        current = index;
+        park(root.handle, now());
+        current = previous;
+        return id;
+    }
+
+    // Executor thread only, including from inside a task (which then ends
+    // at its next await).
+    void cancel(TaskId id) {
+        if (id.index >= roots.size() || roots[id.index].generation != id.generation || !roots[id.index].handle) {
+            return;
+        }
+        if (id.index == current) {
+            roots[id.index].cancelled = true;
+        } else {
+            finish(id.index, true);
+        }
+    }
+
+    // Async-signal-safe.
+    void cancelAll() {
+        cancel_all.store(true, std::memory_order_release);
+        loop.wake();
+    }
+
+    // Async-signal-safe; run() cancels what is left and returns.
+    void stop() {
+        stopping.store(true, std::memory_order_release);
+        loop.wake();
+    }
+
+    // Returns when no task is left, when the next deadline is past `until`
+    // or after stop().
+    void run(std::chrono::nanoseconds until = EventLoop::FOREVER) {
+        while (true) {
+            if (cancel_all.exchange(false, std::memory_order_acq_rel) || stopping.load(std::memory_order_acquire)) {
+                for (uint32_t i = 0; i < roots.size(); ++i) {
+                    if (roots[i].handle) finish(i, true);
+                }
+                if (stopping.load(std::memory_order_acquire)) return;
+            }
+            while (!timers.empty() && !valid(timers.front())) {
+                std::pop_heap(timers.begin(), timers.end());
+                timers.pop_back();
+            }
+            if (timers.empty() || timers.front().at > until) return;
+
+            Timer timer = timers.front();
+            if (virtual_time) {
+                clock = std::max(clock, timer.at);
+            } else if (timer.at > EventLoop::now()) {
+                loop.waitUntil(timer.at);
+                continue;
+            }
+            std::pop_heap(timers.begin(), timers.end());
+            timers.pop_back();
+            resume(timer);
+        }
+    }
+
+    size_t active() const {
+        return live;
+    }
+
+    uint64_t resumes = 0;
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Root {
+        std::coroutine_handle<> handle;
+        Done done = nullptr;
+        void* context = nullptr;
+        uint32_t generation = 0;
+        uint64_t waiting = 0;
+        bool cancelled = false;
+    };
+
+    struct Timer {
+        std::chrono::nanoseconds at;
+        uint64_t sequence;
+        uint32_t index;
+        uint32_t generation;
+        std::coroutine_handle<> handle;
+
+        // Earliest first, then in the order they were set.
+        bool operator<(const Timer& other) const {
+            return at != other.at ? at > other.at : sequence > other.sequence;
+        }
+    };
+
+    // Each task waits on at most one timer; re-parking or ending a task
+    // leaves its old heap entries behind to be dropped when they surface.
+    bool valid(const Timer& timer) const {
+        const Root& root = roots[timer.index];
+        return root.generation == timer.generation && root.waiting == timer.sequence && root.handle;
+    }
+
+    void park(std::coroutine_handle<> waiting, std::chrono::nanoseconds deadline) {
+        Root& root = roots[current];
+        root.waiting = ++sequence;
+        timers.push_back(Timer{deadline, root.waiting, current, root.generation, waiting});
+        std::push_heap(timers.begin(), timers.end());
+    }
+
+    void resume(const Timer& timer) {
+        current = timer.index;
+        roots[timer.index].waiting = 0;
+        timer.handle.resume();
+        resumes += 1;
+        current = NONE;
+        Root& root = roots[timer.index];
+        if (root.handle.done() || root.cancelled) finish(timer.index, root.cancelled);
+    }
+
+    void finish(uint32_t index, bool cancelled) {
+        Root& root = roots[index];
+        root.handle.destroy();
+        root.handle = nullptr;
+        root.generation += 1;
+        root.waiting = 0;
+        live -= 1;
+        free_roots.push_back(index);
+        if (root.done != nullptr) root.done(root.context, cancelled);
+    }
+
+    bool virtual_time;
+    std::chrono::nanoseconds clock{0};
+    FramePool pool;
+    EventLoop loop;
+    std::vector<Root> roots;
+    std::vector<uint32_t> free_roots;
+    std::vector<Timer> timers;
+    uint64_t sequence = 0;
+    uint32_t current = NONE;
+    size_t live = 0;
+    std::atomic<bool> cancel_all{false};
+    std::atomic<bool> stopping{false};
+};
+
+// One crossing whose sequence is a coroutine. phase() and countdown() keep
+// absolute deadlines, as PhaseEngine does, so lateness never accumulates. A
+// cancelled sequence leaves the outputs where it stopped; `finished` then
+// puts them in the safe state, as the controller's setup() does.
+template <class Pins, class Gpio>
+class CoroutineCrossing {
+public:
+    using Plan = TrafficPlan<Pins>;
+
+    CoroutineCrossing(TimerExecutor& executor, Gpio& gpio, const PhasePlan& plan = Plan::PEDESTRIAN)
+        : executor(executor), gpio(gpio), plan(plan) {}
+
+    FramePool& frames() {
+        return executor.frames();
+    }
+
+    TimerExecutor::Sleep phase(uint32_t outputs, std::chrono::nanoseconds length) {
+        setOutputs(outputs);
+        deadline += length;
+        return executor.sleepUntil(deadline);
+    }
+
+    // Shows `seconds` down to 0, one number per second.
+    Task countdown(int seconds) {
+        for (int left = seconds; left >= 0; --left) {
+            shown = left;
+            deadline += std::chrono::seconds(1);
+            co_await executor.sleepUntil(deadline);
+        }
+        shown = -1;
+    }
+
+    Task pedestrianSequence() {
+        deadline = executor.now();
+        for (size_t i = 0; i < plan.count; ++i) {
+            const Phase& step = plan.phases[i];
+            if (step.countdown) {
+                setOutputs(step.outputs);
+                co_await countdown(step.seconds);
+            } else {
+                co_await phase(step.outputs, step.duration());
+            }
+        }
+        setOutputs(plan.rest);
+        cycles += 1;
+    }
+
+    // Pedestrians at random with `mean_gap` between them, each served by a
+    // sequence; presses during one are served by it. Runs until cancelled.
+    Task serve(std::chrono::nanoseconds mean_gap, uint64_t seed) {
+        uint64_t rng = seed * 0x9E3779B97F4A7C15ull + 1;
+        auto press = executor.now();
+        while (true) {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            double uniform = double((rng >> 11) + 1) / double(1ull << 53);
+            press = std::max(press, executor.now()) +
+                    std::chrono::nanoseconds(int64_t(-std::log(uniform) * double(mean_gap.count())));
+            co_await executor.sleepUntil(press);
+            co_await pedestrianSequence();
+        }
+    }
+
+    // TimerExecutor::Done for this crossing's tasks.
+    static void finished(void* context, bool cancelled) {
+        CoroutineCrossing& crossing = *static_cast<CoroutineCrossing*>(context);
+        if (cancelled) {
+            crossing.setOutputs(Plan::SAFE);
+            crossing.shown = -1;
+            crossing.cancellations += 1;
+        }
+    }
+
+    uint32_t outputs = 0;
+    int shown = -1;
+    uint64_t cycles = 0;
+    uint64_t cancellations = 0;
+
+private:
+    void setOutputs(uint32_t next) {
+        outputs = next;
+        gpio.write(next, Plan::OUTPUTS & ~next);
+    }
+
+    TimerExecutor& executor;
+    Gpio& gpio;
+    const PhasePlan& plan;
+    std::chrono::nanoseconds deadline{0};
+};
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Pedestrian demand per minute of wall-clock time: debounced presses,
+// presses that became a request, presses ignored (link down, or a cycle
+// running in fixed mode), presses served by the running cycle, requests
+// from the control API, completed cycles and press-to-walk waits.
+enum DemandCounter {
+    DEMAND_PRESSES,
+    DEMAND_REQUESTS,
+    DEMAND_IGNORED,
+    DEMAND_SERVED,
+    DEMAND_REMOTE,
+    DEMAND_CYCLES,
+    DEMAND_WAITS,
+    DEMAND_WAIT_SECONDS,
+    DEMAND_WAIT_HISTOGRAM,
+    DEMAND_COUNTERS = DEMAND_WAIT_HISTOGRAM + 8,
+};
+
+// Upper edges, in seconds, of the wait histogram's first seven buckets; the
+// eighth takes the rest.
+constexpr uint32_t DEMAND_WAIT_EDGES[7] = {5, 10, 20, 30, 45, 60, 90};
+
+inline int demandWaitBucket(uint32_t seconds) {
+    int bucket = 0;
+    while (bucket < 7 && seconds >= DEMAND_WAIT_EDGES[bucket]) ++bucket;
+    return bucket;
+}
+
+// One bucket of the series, on disk as it is in memory: 64 bytes, so a
+// year of hours is half a megabyte. `start` is in minutes since the Unix
+// epoch; span 0 marks an unused slot.
+struct DemandBucket {
+    uint32_t start;
+    uint16_t span;
+    uint16_t wait_max;
+    uint32_t presses;
+    uint32_t requests;
+    uint32_t ignored;
+    uint32_t served;
+    uint32_t remote;
+    uint32_t cycles;
+    uint32_t waits;
+    uint32_t wait_seconds;
+    uint16_t wait_histogram[8];
+    uint32_t reserved[2];
+};
+
+static_assert(sizeof(DemandBucket) == 64, "demand bucket layout");
+
+inline void mergeBucket(DemandBucket& into, const DemandBucket& from) {
+    auto add32 = [](uint32_t& a, uint32_t b) { a = a + b < a ? UINT32_MAX : a + b; };
+    auto add16 = [](uint16_t& a, uint16_t b) { a = uint16_t(a + b > UINT16_MAX ? UINT16_MAX : a + b); };
+    add32(into.presses, from.presses);
+    add32(into.requests, from.requests);
+    add32(into.ignored, from.ignored);
+    add32(into.served, from.served);
+    add32(into.remote, from.remote);
+    add32(into.cycles, from.cycles);
+    add32(into.waits, from.waits);
+    add32(into.wait_seconds, from.wait_seconds);
+    if (from.wait_max > into.wait_max) into.wait_max = from.wait_max;
+    for (int i = 0; i < 8; ++i) add16(into.wait_histogram[i], from.wait_histogram[i]);
+}
+
+// Counters written from any thread without locks or shared cache lines:
+// each thread claims a slot on first use and only ever stores to it, so an
+// add is a load and a store. Threads past SLOTS share the last slot with
+// atomic adds. collect() runs on one thread, sums the slots and hands out
+// what changed since the last call.
+class DemandStats {
+public:
+    static constexpr int SLOTS = 8;
+
+    void add(DemandCounter counter, uint64_t n = 1) {
+        Slot& slot = mine();
+        if (&slot == &slots[SLOTS - 1]) {
+            slot.counts[counter].fetch_add(n, std::memory_order_relaxed);
+        } else {
+            slot.counts[counter].store(slot.counts[counter].load(std::memory_order_relaxed) + n,
+                                       std::memory_order_relaxed);
+        }
+    }
+
+    void wait(std::chrono::nanoseconds waited) {
+        uint32_t seconds = uint32_t(std::chrono::duration_cast<std::chrono::seconds>(waited).count());
+        add(DEMAND_WAITS);
+        add(DEMAND_WAIT_SECONDS, seconds);
+        add(DemandCounter(DEMAND_WAIT_HISTOGRAM + demandWaitBucket(seconds)));
+        Slot& slot = mine();
+        uint64_t seen = slot.wait_max.load(std::memory_order_relaxed);
+        while (seconds > seen && !slot.wait_max.compare_exchange_weak(seen, seconds, std::memory_order_relaxed)) {
+        }
+    }
+
+    // The counts since the previous collect() as a one-minute bucket.
+    DemandBucket collect(uint32_t minute) {
+        uint64_t totals[DEMAND_COUNTERS] = {};
+        uint64_t wait_max = 0;
+        for (Slot& slot : slots) {
+            for (int i = 0; i < DEMAND_COUNTERS; ++i) totals[i] += slot.counts[i].load(std::memory_order_relaxed);
+            wait_max = std::max<uint64_t>(wait_max, slot.wait_max.exchange(0, std::memory_order_relaxed));
+        }
+        uint64_t delta[DEMAND_COUNTERS];
+        for (int i = 0; i < DEMAND_COUNTERS; ++i) {
+            delta[i] = totals[i] - collected[i];
+            collected[i] = totals[i];
+        }
+        auto clamp32 = [](uint64_t value) { return uint32_t(std::min<uint64_t>(value, UINT32_MAX)); };
+        DemandBucket bucket{};
+        bucket.start = minute;
+        bucket.span = 1;
+        bucket.wait_max = uint16_t(std::min<uint64_t>(wait_max, UINT16_MAX));
+        bucket.presses = clamp32(delta[DEMAND_PRESSES]);
+        bucket.requests = clamp32(delta[DEMAND_REQUESTS]);
+        bucket.ignored = clamp32(delta[DEMAND_IGNORED]);
+        bucket.served = clamp32(delta[DEMAND_SERVED]);
+        bucket.remote = clamp32(delta[DEMAND_REMOTE]);
+        bucket.cycles = clamp32(delta[DEMAND_CYCLES]);
+        bucket.waits = clamp32(delta[DEMAND_WAITS]);
+        bucket.wait_seconds = clamp32(delta[DEMAND_WAIT_SECONDS]);
+        for (int i = 0; i < 8; ++i) {
+            bucket.wait_histogram[i] = uint16_t(std::min<uint64_t>(delta[DEMAND_WAIT_HISTOGRAM + i], UINT16_MAX));
+        }
+        return bucket;
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> counts[DEMAND_COUNTERS] = {};
+        std::atomic<uint64_t> wait_max{0};
+    };
+
+    Slot& mine() {
+        thread_local const DemandStats* owner = nullptr;
+        thread_local int index = 0;
+        if (owner != this) {
+            owner = this;
+            index = std::min(claimed.fetch_add(1, std::memory_order_relaxed), SLOTS - 1);
+        }
+        return slots[index];
+    }
+
+    Slot slots[SLOTS];
+    std::atomic<int> claimed{0};
+    uint64_t collected[DEMAND_COUNTERS] = {};
+};
+
+// File layout: a one-page header, then three rings of buckets - minutes,
+// quarter hours and hours - sharing a fixed budget half, a quarter and a
+// quarter. Every minute merges into the open bucket of each ring, so the
+// coarser rings are downsampled as they go and outlive the finer ones: an
+// 8 MiB budget keeps 45 days of minutes, 11 months of quarters and 3.7
+// years of hours.
+struct DemandRingHeader {
+    uint32_t span;
+    uint32_t capacity;
+    uint64_t offset;
+    uint64_t next;
+};
+
+struct DemandFileHeader {
+    char magic[8];
+    uint32_t bucket_size;
+    uint32_t rings;
+    DemandRingHeader ring[3];
+};
+
+constexpr char DEMAND_MAGIC[8] = {'T', 'L', 'D', 'E', 'M', 'A', 'N', 'D'};
+constexpr uint32_t DEMAND_SPANS[3] = {1, 15, 60};
+constexpr size_t DEMAND_HEADER_SIZE = 4096;
+
+// The mapped file. add() only stores into the page cache; the kernel writes
+// it back on its own schedule, and nothing here ever waits for the SD card.
+class DemandStore {
+public:
+    ~DemandStore() {
+        close();
+    }
+
+    // Reuses an existing file with its own layout; otherwise creates one
+    // within `budget` bytes.
+    bool open(const char* path, size_t budget = 8 << 20, bool writable = true) {
+        int fd = ::open(path, writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) < 0) {
+            ::close(fd);
+            return false;
+        }
+        size_t length = size_t(info.st_size);
+        bool fresh = length < DEMAND_HEADER_SIZE;
+        if (fresh) {
+            if (!writable) {
+                ::close(fd);
+                return false;
+            }
+            length = budget / sizeof(DemandBucket) * sizeof(DemandBucket);
+            if (length < DEMAND_HEADER_SIZE + 4 * sizeof(DemandBucket) || ftruncate(fd, off_t(length)) < 0) {
+                ::close(fd);
+                return false;
+            }
+        }
+        void* map = mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) return false;
+        base = static_cast<uint8_t*>(map);
+        mapped = length;
+        header = reinterpret_cast<DemandFileHeader*>(base);
+
+        if (fresh) {
+            std::memcpy(header->magic, DEMAND_MAGIC, sizeof(DEMAND_MAGIC));
+            header->bucket_size = sizeof(DemandBucket);
+            header->rings = 3;
+            uint64_t buckets = (length - DEMAND_HEADER_SIZE) / sizeof(DemandBucket);
+            uint64_t shares[3] = {buckets / 2, buckets / 4, buckets - buckets / 2 - buckets / 4};
+            uint64_t offset = DEMAND_HEADER_SIZE;
+            for (int i = 0; i < 3; ++i) {
+                header->ring[i] = DemandRingHeader{DEMAND_SPANS[i], uint32_t(shares[i]), offset, 0};
+                offset += shares[i] * sizeof(DemandBucket);
+            }
+        }
+        if (!valid()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (base == nullptr) return;
+        munmap(base, mapped);
+        base = nullptr;
+        header = nullptr;
+    }
+
+    bool active() const {
+        return base != nullptr;
+    }
+
+    // Merges one minute into every ring. Empty minutes are not stored; a
+    // minute already open (a restart within it) or one that went back in
+    // time (the wall clock was stepped) merges into the open bucket.
+    void add(const DemandBucket& minute) {
+        if (base == nullptr) return;
+        if (minute.presses == 0 && minute.remote == 0 && minute.cycles == 0 && minute.ignored == 0 &&
+            minute.waits == 0) {
+            return;
+        }
+        for (int i = 0; i < 3; ++i) {
+            DemandRingHeader& ring = header->ring[i];
+            uint32_t start = minute.start / ring.span * ring.span;
+            DemandBucket* open = ring.next > 0 ? bucket(i, ring.next - 1) : nullptr;
+            if (open == nullptr || start > open->start) {
+                open = bucket(i, ring.next);
+                *open = DemandBucket{};
+                open->start = start;
+                open->span = uint16_t(ring.span);
+                ring.next += 1;
+            }
+            mergeBucket(*open, minute);
+        }
+    }
+
+    const DemandRingHeader& ring(int index) const {
+        return header->ring[index];
+    }
+
+    size_t stored(int index) const {
+        const DemandRingHeader& r = header->ring[index];
+        return size_t(std::min<uint64_t>(r.next, r.capacity));
+    }
+
+    // The `n`th oldest bucket still in the ring.
+    const DemandBucket& oldest(int index, size_t n) const {
+        const DemandRingHeader& r = header->ring[index];
+        uint64_t first = r.next > r.capacity ? r.next - r.capacity : 0;
+        return *const_cast<DemandStore*>(this)->bucket(index, first + n);
+    }
+
+    size_t bytes() const {
+        return mapped;
+    }
+
+private:
+    DemandBucket* bucket(int index, uint64_t sequence) {
+        const DemandRingHeader& r = header->ring[index];
+        return reinterpret_cast<DemandBucket*>(base + r.offset) + sequence % r.capacity;
+    }
+
+    bool valid() const {
+        if (std::memcmp(header->magic, DEMAND_MAGIC, sizeof(DEMAND_MAGIC)) != 0 ||
+            header->bucket_size != sizeof(DemandBucket) || header->rings != 3) {
+            return false;
+        }
+        for (int i = 0; i < 3; ++i) {
+            const DemandRingHeader& r = header->ring[i];
+            if (r.span != DEMAND_SPANS[i] || r.capacity == 0 || r.offset < DEMAND_HEADER_SIZE ||
+                r.offset + uint64_t(r.capacity) * sizeof(DemandBucket) > mapped) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint8_t* base = nullptr;
+    size_t mapped = 0;
+    DemandFileHeader* header = nullptr;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include "glyphFont.h"
+#include "sh1106Framebuffer.h"
+#include "trafficController.h"
+
+constexpr int COUNTDOWN_SCALE = 2;
+constexpr int COUNTDOWN_PAGE = 3;
+constexpr int COUNTDOWN_COL = 44;
+constexpr int STATUS_PAGE = 6;
+constexpr int DISPLAY_CENTER = COUNTDOWN_COL + CountdownAtlas<COUNTDOWN_SCALE>::WIDTH / 2;
+
+// SH1106 power-up sequence for the 128x64 module; the caller submits.
+template <class Bus>
+void sendDisplayInit(Bus& bus) {
+    const uint8_t commands[] = {
+        0xAE,
+        0xD5, 0x80,
+        0xA8, 0x3F,
+        0xD3, 0x00,
+        0x40,
+        0xAD, 0x8B,
+        0xA1,
+        0xC8,
+        0xDA, 0x12,
+        0x81, 0xCF,
+        0xD9, 0xF1,
+        0xDB, 0x40,
+        0xA4,
+        0xA6,
+        0xAF,
+    };
+    for (uint8_t command : commands) bus.command(command);
+}
+
+// Countdown digits in the middle, "NO LINK" or "WAIT" under them. Only
+// draws; flushing is up to the caller.
+inline void renderSnapshot(SH1106Framebuffer& framebuffer, const DisplaySnapshot& snapshot) {
+    if (snapshot.seconds >= 0) {
+        drawCountdown<COUNTDOWN_SCALE>(framebuffer, COUNTDOWN_PAGE, COUNTDOWN_COL, snapshot.seconds);
+    } else {
+        framebuffer.fill(COUNTDOWN_PAGE, COUNTDOWN_PAGE + COUNTDOWN_SCALE, COUNTDOWN_COL,
+                         COUNTDOWN_COL + CountdownAtlas<COUNTDOWN_SCALE>::WIDTH, 0x00);
+    }
+
+    const char* status = "";
+    if (!snapshot.link) {
+        status = "NO LINK";
+    } else if (snapshot.phase >= 0 && snapshot.seconds < 0) {
+        status = "WAIT";
+    }
+    framebuffer.fill(STATUS_PAGE, STATUS_PAGE + 1, 0, SH1106Framebuffer::WIDTH, 0x00);
+    drawText<1>(framebuffer, STATUS_PAGE, DISPLAY_CENTER - textWidth<1>(status) / 2, status);
+}
+
+// Display policy that draws every snapshot on the controller's thread and
+// flushes the changed bytes to `Bus` (I2CTransport, WiringPiRegisterBus,
+// MockBus).
+template <class Bus>
+class FramebufferDisplay {
+public:
+    explicit FramebufferDisplay(Bus& bus) : bus(bus) {}
+
+    void init() {
+        sendDisplayInit(bus);
+        bus.submit();
+        framebuffer.invalidate();
+        clear();
+    }
+
+    void clear() {
+        framebuffer.clear();
+        framebuffer.flush(bus);
+    }
+
+    void off() {
+        bus.command(0xAE);
+        bus.submit();
+    }
+
+    void show(const DisplaySnapshot& snapshot) {
+        renderSnapshot(framebuffer, snapshot);
+        framebuffer.flush(bus);
+    }
+
+    SH1106Framebuffer framebuffer;
+
+private:
+    Bus& bus;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+// One timerfd armed with absolute CLOCK_MONOTONIC deadlines plus an eventfd
+// for wakeups, both behind one epoll descriptor. Waiting costs no wakeups
+// until either the deadline passes or somebody calls wake().
+class EventLoop {
+public:
+    static constexpr std::chrono::nanoseconds FOREVER = std::chrono::nanoseconds::max();
+
+    EventLoop() {
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = timer_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+        event.data.fd = wake_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+    }
+
+    ~EventLoop() {
+        close(epoll_fd);
+        close(wake_fd);
+        close(timer_fd);
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    static std::chrono::nanoseconds now() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+    }
+
+    // Blocks until `deadline` on the monotonic clock (true) or until wake()
+    // is called (false). A wake() that came first is not lost.
+    bool waitUntil(std::chrono::nanoseconds deadline) {
+        if (deadline != FOREVER && deadline <= now()) return true;
+
+        itimerspec spec{};
+        if (deadline != FOREVER) {
+            spec.it_value.tv_sec = deadline.count() / 1000000000;
+            spec.it_value.tv_nsec = deadline.count() % 1000000000;
+        }
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+
+        while (true) {
+            epoll_event events[2];
+            int count = epoll_wait(epoll_fd, events, 2, -1);
+            bool woken = false;
+            bool expired = false;
+            for (int i = 0; i < count; ++i) {
+                uint64_t value;
+                if (events[i].data.fd == wake_fd) {
+                    woken = read(wake_fd, &value, sizeof(value)) == sizeof(value);
+                } else {
+                    expired = read(timer_fd, &value, sizeof(value)) == sizeof(value);
+                }
+            }
+            if (woken) return false;
+            if (expired) return true;
+        }
+    }
+
+    // Async-signal-safe.
+    void wake() {
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+private:
+    int timer_fd = -1;
+    int wake_fd = -1;
+    int epoll_fd = -1;
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// What the controller saw and did, in the order it happened: button edges,
+// link changes and remote walk requests are the inputs a replay feeds back;
+// phase outputs are what it checks the replay against.
+enum TraceKind : uint8_t {
+    TRACE_PAD = 0,
+    TRACE_EDGE = 1,
+    TRACE_LINK = 2,
+    TRACE_PHASE = 3,
+    TRACE_MODE = 4,
+    TRACE_REQUEST = 5,
+};
+
+struct TraceEvent {
+    std::chrono::nanoseconds at;
+    TraceKind kind;
+    uint64_t value;
+};
+
+// File layout: one header block, then a ring of fixed-size blocks. Each block
+// starts with an absolute timestamp; its records carry the zigzag varint
+// delta to the previous record's time and a varint value, so a typical
+// record is 5-8 bytes and any block decodes on its own after the ring
+// wraps. Records never straddle blocks.
+struct TraceFileHeader {
+    char magic[8];
+    uint32_t block_size;
+    uint32_t blocks;
+    uint64_t next_block;
+};
+
+struct TraceBlockHeader {
+    int64_t base;
+    uint32_t used;
+    uint32_t reserved;
+};
+
+constexpr char TRACE_MAGIC[8] = {'T', 'L', 'T', 'R', 'A', 'C', 'E', '1'};
+constexpr uint32_t TRACE_BLOCK_SIZE = 4096;
+
+inline uint8_t* putVarint(uint8_t* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = uint8_t(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = uint8_t(value);
+    return out;
+}
+
+inline const uint8_t* getVarint(const uint8_t* in, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        uint8_t byte = *in++;
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return in;
+    }
+    return nullptr;
+}
+
+// Appends records to a memory-mapped ring file. A record is a few stores
+// into the page cache; nothing is flushed, so the trace survives a crash of
+// the process (not of the kernel). One writer: the controller thread, which
+// records the button, link and request inputs as it takes them, so nothing
+// here locks - a spin lock shared with a higher-priority SCHED_FIFO thread on
+// the same CPU could spin forever.
+class TraceRecorder {
+public:
+    // Earlier runs kept next to a new trace: FILE.1 is the previous one.
+    static constexpr int KEEP = 3;
+
+    ~TraceRecorder() {
+        close();
+    }
+
+    // A trace already at `path` is the run before this one - after a crash
+    // or a watchdog restart, the one the trace is for - so it moves to
+    // path.1, the older ones one further up to path.KEEP, and only then is
+    // a new file started. Fails rather than overwrite one it cannot move.
+    bool open(const char* path, size_t bytes = 4 << 20) {
+        uint32_t blocks = uint32_t(bytes / TRACE_BLOCK_SIZE);
+        if (blocks < 2) blocks = 2;
+        size_t length = size_t(blocks + 1) * TRACE_BLOCK_SIZE;
+
+        for (int run = KEEP; run > 0; --run) {
+            std::string from = run > 1 ? std::string(path) + "." + std::to_string(run - 1) : std::string(path);
+            std::string to = std::string(path) + "." + std::to_string(run);
+            if (std::rename(from.c_str(), to.c_str()) < 0 && errno != ENOENT) return false;
+        }
+        int fd = ::open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        if (ftruncate(fd, off_t(length)) < 0) {
+            ::close(fd);
+            return false;
+        }
+        void* map = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) return false;
+
+        base = static_cast<uint8_t*>(map);
+        mapped = length;
+        header = reinterpret_cast<TraceFileHeader*>(base);
+        std::memcpy(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        header->block_size = TRACE_BLOCK_SIZE;
+        header->blocks = blocks;
+        header->next_block = 0;
+        block = nullptr;
+        return true;
+    }
+
+    void close() {
+        if (base == nullptr) return;
+        munmap(base, mapped);
+        base = nullptr;
+        header = nullptr;
+        block = nullptr;
+    }
+
+    bool active() const {
+        return base != nullptr;
+    }
+
+    void record(TraceKind kind, std::chrono::nanoseconds at, uint64_t value) {
+        if (base == nullptr) return;
+
+        // Worst case: kind + two 10-byte varints.
+        if (block == nullptr || block->used + 21 > TRACE_BLOCK_SIZE) startBlock(at);
+        int64_t delta = at.count() - last;
+        uint8_t* start = reinterpret_cast<uint8_t*>(block) + block->used;
+        uint8_t* out = start;
+        *out++ = kind;
+        out = putVarint(out, (uint64_t(delta) << 1) ^ uint64_t(delta >> 63));
+        out = putVarint(out, value);
+        block->used += uint32_t(out - start);
+        last = at.count();
+        records += 1;
+        bytes += uint64_t(out - start);
+    }
+
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+
+private:
+    void startBlock(std::chrono::nanoseconds at) {
+        uint64_t index = header->next_block;
+        block = reinterpret_cast<TraceBlockHeader*>(base + (1 + index % header->blocks) * TRACE_BLOCK_SIZE);
+        block->base = at.count();
+        block->used = sizeof(TraceBlockHeader);
+        last = at.count();
+        header->next_block = index + 1;
+    }
+
+    uint8_t* base = nullptr;
+    size_t mapped = 0;
+    TraceFileHeader* header = nullptr;
+    TraceBlockHeader* block = nullptr;
+    int64_t last = 0;
+};
+
+// Decodes every block still in the ring, oldest first.
+inline bool readTrace(const char* path, std::vector<TraceEvent>& events) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) < 0 || size_t(info.st_size) < 2 * TRACE_BLOCK_SIZE) {
+        ::close(fd);
+        return false;
+    }
+    size_t length = size_t(info.st_size);
+    void* map = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const uint8_t* base = static_cast<const uint8_t*>(map);
+    const TraceFileHeader* header = reinterpret_cast<const TraceFileHeader*>(base);
+    bool ok = std::memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 &&
+              header->block_size == TRACE_BLOCK_SIZE && (header->blocks + 1) * size_t(TRACE_BLOCK_SIZE) <= length;
+    uint64_t first = header->next_block > header->blocks ? header->next_block - header->blocks : 0;
+    for (uint64_t index = first; ok && index < header->next_block; ++index) {
+        const uint8_t* block = base + (1 + index % header->blocks) * TRACE_BLOCK_SIZE;
+        const TraceBlockHeader* block_header = reinterpret_cast<const TraceBlockHeader*>(block);
+        const uint8_t* in = block + sizeof(TraceBlockHeader);
+        const uint8_t* end = block + (block_header->used <= TRACE_BLOCK_SIZE ? block_header->used : 0);
+        int64_t at = block_header->base;
+        while (in != nullptr && in < end) {
+            TraceKind kind = TraceKind(*in++);
+            uint64_t delta, value;
+            in = getVarint(in, end, delta);
+            if (in != nullptr) in = getVarint(in, end, value);
+            if (in == nullptr) break;
+            at += int64_t(delta >> 1) ^ -int64_t(delta & 1);
+            events.push_back(TraceEvent{std::chrono::nanoseconds(at), kind, value});
+        }
+    }
+    munmap(map, length);
+    return ok;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include "sh1106Framebuffer.h"
+
+// 5x7 font for ' '..'Z', one byte per column with the top row in bit 0, the
+// way SH1106 pages are laid out. Lowercase letters are drawn as uppercase.
+constexpr char FIRST_GLYPH = ' ';
+constexpr char LAST_GLYPH = 'Z';
+constexpr int GLYPH_COUNT = LAST_GLYPH - FIRST_GLYPH + 1;
+constexpr int GLYPH_COLUMNS = 5;
+constexpr int GLYPH_ADVANCE = GLYPH_COLUMNS + 1;
+
+constexpr uint8_t FONT5X7[GLYPH_COUNT][GLYPH_COLUMNS] = {
+    {0x00,0x00,0x00,0x00,0x00}, {0x00,0x00,0x5F,0x00,0x00}, {0x00,0x07,0x00,0x07,0x00}, // ' ' ! "
+    {0x14,0x7F,0x14,0x7F,0x14}, {0x24,0x2A,0x7F,0x2A,0x12}, {0x23,0x13,0x08,0x64,0x62}, // # $ %
+    {0x36,0x49,0x56,0x20,0x50}, {0x00,0x08,0x07,0x03,0x00}, {0x00,0x1C,0x22,0x41,0x00}, // & ' (
+    {0x00,0x41,0x22,0x1C,0x00}, {0x2A,0x1C,0x7F,0x1C,0x2A}, {0x08,0x08,0x3E,0x08,0x08}, // ) * +
+    {0x00,0x80,0x70,0x30,0x00}, {0x08,0x08,0x08,0x08,0x08}, {0x00,0x00,0x60,0x60,0x00}, // , - .
+    {0x20,0x10,0x08,0x04,0x02},                                                         // /
+    {0x3E,0x51,0x49,0x45,0x3E}, {0x00,0x42,0x7F,0x40,0x00}, {0x42,0x61,0x51,0x49,0x46}, // 0 1 2
+    {0x21,0x41,0x45,0x4B,0x31}, {0x18,0x14,0x12,0x7F,0x10}, {0x27,0x45,0x45,0x45,0x39}, // 3 4 5
+    {0x3C,0x4A,0x49,0x49,0x30}, {0x01,0x71,0x09,0x05,0x03}, {0x36,0x49,0x49,0x49,0x36}, // 6 7 8
+    {0x06,0x49,0x49,0x29,0x1E},                                                         // 9
+    {0x00,0x36,0x36,0x00,0x00}, {0x00,0x56,0x36,0x00,0x00}, {0x08,0x14,0x22,0x41,0x00}, // : ; <
+    {0x14,0x14,0x14,0x14,0x14}, {0x00,0x41,0x22,0x14,0x08}, {0x02,0x01,0x51,0x09,0x06}, // = > ?
+    {0x3E,0x41,0x5D,0x59,0x4E},                                                         // @
+    {0x7E,0x11,0x11,0x11,0x7E}, {0x7F,0x49,0x49,0x49,0x36}, {0x3E,0x41,0x41,0x41,0x22}, // A B C
+    {0x7F,0x41,0x41,0x22,0x1C}, {0x7F,0x49,0x49,0x49,0x41}, {0x7F,0x09,0x09,0x09,0x01}, // D E F
+    {0x3E,0x41,0x49,0x49,0x7A}, {0x7F,0x08,0x08,0x08,0x7F}, {0x00,0x41,0x7F,0x41,0x00}, // G H I
+    {0x20,0x40,0x41,0x3F,0x01}, {0x7F,0x08,0x14,0x22,0x41}, {0x7F,0x40,0x40,0x40,0x40}, // J K L
+    {0x7F,0x02,0x0C,0x02,0x7F}, {0x7F,0x04,0x08,0x10,0x7F}, {0x3E,0x41,0x41,0x41,0x3E}, // M N O
+    {0x7F,0x09,0x09,0x09,0x06}, {0x3E,0x41,0x51,0x21,0x5E}, {0x7F,0x09,0x19,0x29,0x46}, // P Q R
+    {0x46,0x49,0x49,0x49,0x31}, {0x01,0x01,0x7F,0x01,0x01}, {0x3F,0x40,0x40,0x40,0x3F}, // S T U
+    {0x1F,0x20,0x40,0x20,0x1F}, {0x3F,0x40,0x38,0x40,0x3F}, {0x63,0x14,0x08,0x14,0x63}, // V W X
+    {0x07,0x08,0x70,0x08,0x07}, {0x61,0x51,0x49,0x45,0x43},                             // Y Z
+};
+
+constexpr int glyphIndex(char c) {
+    if (c >= 'a' && c <= 'z') c = char(c - 'a' + 'A');
+    if (c < FIRST_GLYPH || c > LAST_GLYPH) return 0;
+    return c - FIRST_GLYPH;
+}
+
+// Page byte `page` of a font column blown up `scale` times vertically: row r
+// of the output takes source row r / scale.
+constexpr uint8_t scaleColumn(uint8_t column, int scale, int page) {
+    uint8_t out = 0;
+    for (int bit = 0; bit < 8; ++bit) {
+        int source = (page * 8 + bit) / scale;
+        if (source < 8 && (column >> source & 1)) out |= uint8_t(1 << bit);
+    }
+    return out;
+}
+
+// Every glyph at `Scale`, ready to blit: PAGES rows of WIDTH page bytes,
+// spacing column included.
+template <int Scale>
+struct ScaledFont {
+    static_assert(Scale >= 1 && Scale <= 3, "only 1x, 2x and 3x fonts are built");
+    static constexpr int WIDTH = GLYPH_ADVANCE * Scale;
+    static constexpr int PAGES = Scale;
+
+    uint8_t glyphs[GLYPH_COUNT][PAGES][WIDTH];
+};
+
+template <int Scale>
+constexpr ScaledFont<Scale> makeFont() {
+    ScaledFont<Scale> font{};
+    for (int glyph = 0; glyph < GLYPH_COUNT; ++glyph) {
+        for (int page = 0; page < Scale; ++page) {
+            for (int x = 0; x < ScaledFont<Scale>::WIDTH; ++x) {
+                int column = x / Scale;
+                font.glyphs[glyph][page][x] =
+                    column < GLYPH_COLUMNS ? scaleColumn(FONT5X7[glyph][column], Scale, page) : 0;
+            }
+        }
+    }
+    return font;
+}
+
+template <int Scale>
+inline constexpr ScaledFont<Scale> FONT = makeFont<Scale>();
+
+// "00".."99" pre-rendered at `Scale`: a countdown frame is one contiguous
+// span per page.
+template <int Scale>
+struct CountdownAtlas {
+    static constexpr int WIDTH = 2 * ScaledFont<Scale>::WIDTH;
+    static constexpr int PAGES = Scale;
+
+    uint8_t frames[100][PAGES][WIDTH];
+};
+
+template <int Scale>
+constexpr CountdownAtlas<Scale> makeCountdownAtlas() {
+    CountdownAtlas<Scale> atlas{};
+    constexpr int digit_width = ScaledFont<Scale>::WIDTH;
+    for (int value = 0; value < 100; ++value) {
+        int tens = glyphIndex(char('0' + value / 10));
+        int ones = glyphIndex(char('0' + value % 10));
+        for (int page = 0; page < Scale; ++page) {
+            for (int x = 0; x < digit_width; ++x) {
+                atlas.frames[value][page][x] = FONT<Scale>.glyphs[tens][page][x];
+                atlas.frames[value][page][digit_width + x] = FONT<Scale>.glyphs[ones][page][x];
+            }
+        }
+    }
+    return atlas;
+}
+
+template <int Scale>
+inline constexpr CountdownAtlas<Scale> COUNTDOWN_ATLAS = makeCountdownAtlas<Scale>();
+
+template <int Scale>
+constexpr int textWidth(const char* text) {
+    int length = 0;
+    while (text[length] != '\0') ++length;
+    return length * ScaledFont<Scale>::WIDTH;
+}
+
+// Glyph spans are copied side by side into one row per page, then each page
+// goes to the framebuffer as a single blit. Returns the columns drawn.
+template <int Scale>
+int drawText(SH1106Framebuffer& framebuffer, int page, int col, const char* text) {
+    constexpr int width = ScaledFont<Scale>::WIDTH;
+    constexpr int max_glyphs = SH1106Framebuffer::WIDTH / width + 1;
+    int count = 0;
+    while (count < max_glyphs && text[count] != '\0') ++count;
+
+    uint8_t row[max_glyphs * width];
+    for (int p = 0; p < Scale; ++p) {
+        for (int i = 0; i < count; ++i) {
+            std::memcpy(row + i * width, FONT<Scale>.glyphs[glyphIndex(text[i])][p], width);
+        }
+        framebuffer.blit(page + p, col, row, count * width);
+    }
+    return count * width;
+}
+
+template <int Scale>
+void drawCountdown(SH1106Framebuffer& framebuffer, int page, int col, int value) {
+    if (value < 0) value = 0;
+    if (value > 99) value = 99;
+    for (int p = 0; p < Scale; ++p) {
+        framebuffer.blit(page + p, col, COUNTDOWN_ATLAS<Scale>.frames[value][p], CountdownAtlas<Scale>::WIDTH);
+    }
+}
+
+static_assert(glyphIndex('W') == 'W' - FIRST_GLYPH && glyphIndex('w') == glyphIndex('W'), "glyph lookup");
+static_assert(scaleColumn(0x01, 2, 0) == 0x03 && scaleColumn(0x80, 2, 1) == 0xC0, "2x rows double");
+static_assert(scaleColumn(0xFF, 3, 2) == 0xFF, "3x covers three pages");
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/gpio.h>
+
+constexpr uint32_t pinMask(int pin) {
+    return 1u << pin;
+}
+
+// Drives a whole phase through the BCM283x GPSET0/GPCLR0 registers: one store
+// sets every new pin, the next clears every old one, so no pin that stays lit
+// ever drops out. The register block can come from /dev/gpiomem, from a
+// regular file of the same size, or from plain memory in tests.
+class GpioMemBank {
+public:
+    static constexpr int GPSET0 = 0x1C / 4;
+    static constexpr int GPCLR0 = 0x28 / 4;
+    static constexpr size_t BLOCK_SIZE = 4096;
+
+    ~GpioMemBank() {
+        if (mapped) munmap(const_cast<uint32_t*>(regs), BLOCK_SIZE);
+    }
+
+    bool open(const char* path = "/dev/gpiomem") {
+        int fd = ::open(path, O_RDWR | O_SYNC | O_CLOEXEC);
+        if (fd < 0) return false;
+        void* block = mmap(nullptr, BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (block == MAP_FAILED) return false;
+        regs = static_cast<volatile uint32_t*>(block);
+        mapped = true;
+        return true;
+    }
+
+    void attach(volatile uint32_t* registers) {
+        regs = registers;
+    }
+
+    bool ready() const {
+        return regs != nullptr;
+    }
+
+    void write(uint32_t set_mask, uint32_t clear_mask) {
+        if (set_mask) regs[GPSET0] = set_mask;
+        if (clear_mask) regs[GPCLR0] = clear_mask;
+    }
+
+private:
+    volatile uint32_t* regs = nullptr;
+    bool mapped = false;
+};
+
+// Same job through the GPIO character device: every output line is held in
+// one request and a phase is a single GPIO_V2_LINE_SET_VALUES ioctl.
+class GpioChipBank {
+public:
+    ~GpioChipBank() {
+        if (line_fd >= 0) close(line_fd);
+    }
+
+    bool open(uint32_t pins, const char* chip = "/dev/gpiochip0") {
+        int chip_fd = ::open(chip, O_RDWR | O_CLOEXEC);
+        if (chip_fd < 0) return false;
+
+        gpio_v2_line_request request;
+        std::memset(&request, 0, sizeof(request));
+        std::strncpy(request.consumer, "traffic-light", sizeof(request.consumer) - 1);
+        request.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+        for (int pin = 0; pin < 32; ++pin) {
+            index[pin] = -1;
+            if (pins & pinMask(pin)) {
+                index[pin] = request.num_lines;
+                request.offsets[request.num_lines++] = pin;
+            }
+        }
+
+        int result = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &request);
+        close(chip_fd);
+        if (result < 0) return false;
+        line_fd = request.fd;
+        return true;
+    }
+
+    bool ready() const {
+        return line_fd >= 0;
+    }
+
+    void write(uint32_t set_mask, uint32_t clear_mask) {
+        gpio_v2_line_values values{0, 0};
+        for (int pin = 0; pin < 32; ++pin) {
+            if (index[pin] < 0) continue;
+            uint64_t line = uint64_t(1) << index[pin];
+            if (set_mask & pinMask(pin)) {
+                values.bits |= line;
+                values.mask |= line;
+            } else if (clear_mask & pinMask(pin)) {
+                values.mask |= line;
+            }
+        }
+        ioctl(line_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+    }
+
+private:
+    int line_fd = -1;
+    int index[32];
+};
@@ -0,0 +1,372 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "eventLoop.h"
+#include "phaseEngine.h"
+
+// Coordination along a corridor. One controller leads: it owns the cycle
+// length and the epoch it started from. Every other one estimates its clock
+// offset to the leader with NTP-style exchanges over UDP and starts its
+// pedestrian service at its own offset within the shared cycle, so the gaps
+// each crossing leaves in the traffic line up along the corridor.
+enum WaveOp : uint8_t {
+    WAVE_SYNC = 1,
+    WAVE_REPLY = 2,
+};
+
+constexpr uint16_t WAVE_MAGIC = 0x5747;
+constexpr uint8_t WAVE_VERSION = 1;
+
+// t1 is when the follower sent the request, t2 and t3 when the leader got it
+// and answered, each on the sender's clock in ns. A reply also carries the
+// cycle and its epoch on the leader's clock.
+struct WaveFrame {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t op;
+    uint32_t node;
+    int64_t t1;
+    int64_t t2;
+    int64_t t3;
+    int64_t cycle;
+    int64_t epoch;
+};
+
+static_assert(sizeof(WaveFrame) == 48, "wave frame layout");
+
+struct ClockSample {
+    std::chrono::nanoseconds offset;
+    std::chrono::nanoseconds delay;
+};
+
+// One exchange: the leader's clock minus ours, exact when both legs take
+// equally long and never further off than delay / 2.
+inline ClockSample clockSample(std::chrono::nanoseconds t1, std::chrono::nanoseconds t2, std::chrono::nanoseconds t3,
+                               std::chrono::nanoseconds t4) {
+    return ClockSample{((t2 - t1) + (t3 - t4)) / 2, (t4 - t1) - (t3 - t2)};
+}
+
+// NTP's clock filter, reduced: of the last SAMPLES exchanges the one with
+// the shortest round trip queued least, so its offset is the one trusted.
+class ClockFilter {
+public:
+    static constexpr int SAMPLES = 8;
+
+    void add(const ClockSample& sample) {
+        samples[added % SAMPLES] = sample;
+        added += 1;
+    }
+
+    bool ready() const {
+        return added >= SAMPLES / 2;
+    }
+
+    ClockSample best() const {
+        int count = added < SAMPLES ? int(added) : SAMPLES;
+        ClockSample best = {std::chrono::nanoseconds(0), std::chrono::nanoseconds::max()};
+        for (int i = 0; i < count; ++i) {
+            if (samples[i].delay < best.delay) best = samples[i];
+        }
+        return best;
+    }
+
+    uint64_t count() const {
+        return added;
+    }
+
+private:
+    ClockSample samples[SAMPLES] = {};
+    uint64_t added = 0;
+};
+
+// One node of the corridor on its own thread. `apply` gets the service
+// window on this process's monotonic clock whenever it is (re)computed; the
+// leader applies its own once, a follower after every exchange once its
+// filter is ready. `skew` shifts this node's clock, so processes sharing one
+// machine can be tested as if their clocks differed.
+class GreenWave {
+public:
+    explicit GreenWave(void (*apply)(std::chrono::nanoseconds cycle, std::chrono::nanoseconds origin))
+        : apply(apply) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        add(wake_fd);
+    }
+
+    ~GreenWave() {
+        if (fd >= 0) close(fd);
+        close(wake_fd);
+        close(epoll_fd);
+    }
+
+    GreenWave(const GreenWave&) = delete;
+    GreenWave& operator=(const GreenWave&) = delete;
+
+    // Port 0 picks a free one; port() tells which.
+    bool lead(uint16_t port, std::chrono::nanoseconds cycle_length, std::chrono::nanoseconds window_offset,
+              const char* address = "0.0.0.0") {
+        if (cycle_length.count() <= 0 || !open(address, port, true)) return false;
+        leader = true;
+        cycle = cycle_length;
+        offset = window_offset;
+        epoch = now();
+        return true;
+    }
+
+    bool follow(const char* address, uint16_t port, std::chrono::nanoseconds window_offset) {
+        if (port == 0 || !open(address, port, false)) return false;
+        leader = false;
+        offset = window_offset;
+        return true;
+    }
+
+    uint16_t port() const {
+        sockaddr_in addr{};
+        socklen_t length = sizeof(addr);
+        if (fd < 0 || getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &length) < 0) return 0;
+        return ntohs(addr.sin_port);
+    }
+
+    std::chrono::nanoseconds now() const {
+        return EventLoop::now() + skew;
+    }
+
+    // Blocks until stop(). Safe to call stop() from a signal handler.
+    void run() {
+        if (leader) publishWindow();
+        auto next_poll = EventLoop::now();
+        while (!stopping) {
+            int timeout = -1;
+            if (!leader) {
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next_poll - EventLoop::now());
+                timeout = wait.count() > 0 ? int(wait.count()) : 0;
+            }
+            epoll_event events[2];
+            int count = epoll_wait(epoll_fd, events, 2, timeout);
+            if (count < 0 && errno != EINTR) return;
+            for (int i = 0; i < count; ++i) {
+                if (events[i].data.fd == wake_fd) {
+                    uint64_t value;
+                    ssize_t n = read(wake_fd, &value, sizeof(value));
+                    (void)n;
+                } else {
+                    receive();
+                }
+            }
+            // A quick burst fills the filter, then one exchange per poll.
+            if (!leader && EventLoop::now() >= next_poll) {
+                sendSync();
+                next_poll = EventLoop::now() + (filter.count() < uint64_t(ClockFilter::SAMPLES) ? poll / 10 : poll);
+            }
+        }
+    }
+
+    void stop() {
+        stopping = true;
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    // Leader's clock minus ours, from the best exchange; zero on the leader.
+    std::chrono::nanoseconds offsetToLeader() const {
+        return leader || filter.count() == 0 ? std::chrono::nanoseconds(0) : filter.best().offset;
+    }
+
+    bool synchronized() const {
+        return leader || (filter.ready() && cycle.count() > 0);
+    }
+
+    std::chrono::nanoseconds skew{0};
+    std::chrono::nanoseconds poll{std::chrono::seconds(1)};
+    uint32_t node = 0;
+    ClockFilter filter;
+    std::chrono::nanoseconds cycle{0};
+    std::chrono::nanoseconds epoch{0};
+    uint64_t answered = 0;
+    uint64_t exchanges = 0;
+
+private:
+    void add(int descriptor) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = descriptor;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, descriptor, &event);
+    }
+
+    bool open(const char* address, uint16_t port, bool bound) {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) return false;
+        int descriptor = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (descriptor < 0) return false;
+        int result = bound ? bind(descriptor, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))
+                           : connect(descriptor, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        if (result < 0) {
+            close(descriptor);
+            return false;
+        }
+        fd = descriptor;
+        add(fd);
+        return true;
+    }
+
+    void sendSync() {
+        WaveFrame frame{};
+        frame.magic = WAVE_MAGIC;
+        frame.version = WAVE_VERSION;
+        frame.op = WAVE_SYNC;
+        frame.node = node;
+        outstanding = now().count();
+        frame.t1 = outstanding;
+        ssize_t sent = send(fd, &frame, sizeof(frame), MSG_DONTWAIT);
+        (void)sent;
+    }
+
+    void receive() {
+        while (true) {
+            WaveFrame frame;
+            sockaddr_in peer{};
+            socklen_t length = sizeof(peer);
+            ssize_t n = recvfrom(fd, &frame, sizeof(frame), MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&peer), &length);
+            auto received = now();
+            if (n < 0) return;
+            if (n != sizeof(frame) || frame.magic != WAVE_MAGIC || frame.version != WAVE_VERSION) continue;
+
+            if (leader && frame.op == WAVE_SYNC) {
+                frame.op = WAVE_REPLY;
+                frame.t2 = received.count();
+                frame.cycle = cycle.count();
+                frame.epoch = epoch.count();
+                frame.t3 = now().count();
+                sendto(fd, &frame, sizeof(frame), MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&peer), length);
+                answered += 1;
+            } else if (!leader && frame.op == WAVE_REPLY && frame.t1 == outstanding) {
+                // Only the newest request counts: a late reply to an older
+                // one has queued somewhere and would skew the filter.
+                outstanding = 0;
+                filter.add(clockSample(std::chrono::nanoseconds(frame.t1), std::chrono::nanoseconds(frame.t2),
+                                       std::chrono::nanoseconds(frame.t3), received));
+                exchanges += 1;
+                cycle = std::chrono::nanoseconds(frame.cycle);
+                epoch = std::chrono::nanoseconds(frame.epoch);
+                if (synchronized()) publishWindow();
+            }
+        }
+    }
+
+    // Our window starts `offset` into each leader cycle; on our monotonic
+    // clock that is the leader's epoch moved by the offset between clocks.
+    void publishWindow() {
+        apply(cycle, epoch + offset - offsetToLeader() - skew);
+    }
+
+    void (*apply)(std::chrono::nanoseconds, std::chrono::nanoseconds);
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    int fd = -1;
+    bool leader = false;
+    std::chrono::nanoseconds offset{0};
+    int64_t outstanding = 0;
+    std::atomic<bool> stopping{false};
+};
+
+// How long a pedestrian sequence keeps cars from going, counted from the
+// first phase without car green: the part of a service window traffic
+// actually loses.
+inline std::chrono::nanoseconds carsHeld(const PhasePlan& plan, const SignalLayout& signals) {
+    std::chrono::nanoseconds held{0};
+    bool stopped = false;
+    for (size_t i = 0; i < plan.count; ++i) {
+        if (!(plan.phases[i].outputs & signals.car_green)) stopped = true;
+        if (stopped) held += plan.phases[i].duration();
+    }
+    return held;
+}
+
+// A corridor of `crossings` crossings `travel` apart in driving time, each
+// serving pedestrians once per `cycle` and holding cars for `held`. Cars
+// enter at saturation flow, one per `headway`; every crossing passes at most
+// one per `headway` while it is not holding them, and only when the next
+// block has room: `storage` cars queue between two crossings, the rest back
+// up through the one behind.
+struct CorridorModel {
+    int crossings;
+    std::chrono::nanoseconds travel;
+    std::chrono::nanoseconds cycle;
+    std::chrono::nanoseconds held;
+    std::chrono::nanoseconds headway;
+    int storage;
+    std::chrono::nanoseconds duration;
+};
+
+// Vehicles out of the far end within the duration, and for them the time
+// and stops (waits over a second) after the first crossing, whose queue only
+// measures demand.
+struct CorridorResult {
+    uint64_t vehicles;
+    double travel_seconds;
+    double stops;
+};
+
+// Window offsets along a green wave: each crossing stops cars exactly when
+// the gap the previous one left arrives.
+inline std::vector<std::chrono::nanoseconds> waveOffsets(const CorridorModel& model) {
+    std::vector<std::chrono::nanoseconds> offsets;
+    for (int i = 0; i < model.crossings; ++i) offsets.push_back((model.travel * i) % model.cycle);
+    return offsets;
+}
+
+// Cars are first in, first out everywhere, so each one is driven through
+// the whole corridor in entry order against the departures of those ahead.
+inline CorridorResult simulateCorridor(const CorridorModel& model, const std::vector<std::chrono::nanoseconds>& offsets) {
+    std::vector<std::vector<std::chrono::nanoseconds>> left(model.crossings);
+    CorridorResult result = {0, 0, 0};
+    uint64_t stops = 0;
+    std::chrono::nanoseconds travelled{0};
+    for (auto entered = std::chrono::nanoseconds(0); entered < model.duration; entered += model.headway) {
+        size_t car = left[0].size();
+        auto at = entered;
+        auto first = at;
+        uint64_t stopped = 0;
+        for (int i = 0; i < model.crossings; ++i) {
+            auto leave = at;
+            if (car > 0) leave = std::max(leave, left[i][car - 1] + model.headway);
+            if (i + 1 < model.crossings && car >= size_t(model.storage)) {
+                leave = std::max(leave, left[i + 1][car - model.storage]);
+            }
+            auto since = (leave - offsets[i]) % model.cycle;
+            if (since.count() < 0) since += model.cycle;
+            if (since < model.held) leave += model.held - since;
+            if (i == 0) {
+                first = leave;
+            } else if (leave - at > std::chrono::seconds(1)) {
+                stopped += 1;
+            }
+            left[i].push_back(leave);
+            at = leave + model.travel;
+        }
+        if (at - model.travel > model.duration) continue;
+        result.vehicles += 1;
+        stops += stopped;
+        travelled += at - model.travel - first;
+    }
+    if (result.vehicles > 0) {
+        result.travel_seconds = travelled.count() / 1e9 / double(result.vehicles);
+        result.stops = double(stops) / double(result.vehicles);
+    }
+    return result;
+}
@@ -0,0 +1,398 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <thread>
+#include <vector>
+#include <wiringPi.h>
+#include <wiringPiI2C.h>
+#include "i2cTransport.h"
+#include "gpioPhase.h"
+#include "eventLoop.h"
+#include "buttonEdges.h"
+
+// Everything the controller needs from the board: GPIO, the display bus and
+// a monotonic clock. PiHal drives the real hardware, SimHal runs on a
+// virtual clock so whole pedestrian cycles take microseconds.
+class Hal {
+public:
+    virtual ~Hal() = default;
+    virtual bool setup() = 0;
+    virtual void pinMode(int pin, int mode) = 0;
+    virtual void pullUp(int pin) = 0;
+    virtual void digitalWrite(int pin, int value) = 0;
+    virtual void configureOutputs(uint32_t pins) = 0;
+    // Switches every pin in set_mask on and every pin in clear_mask off as
+    // one operation.
+    virtual void writePins(uint32_t set_mask, uint32_t clear_mask) = 0;
+    virtual int digitalRead(int pin) = 0;
+    // Delivers falling edges of the button line, each with the time it
+    // happened; called from an interrupt thread, never the controller's.
+    virtual bool attachButton(int pin, void (*on_edge)(const ButtonEdge&)) = 0;
+    virtual I2CBackend* openI2C(int bus) = 0;
+    virtual std::chrono::nanoseconds now() = 0;
+    // Sleeps until the absolute `deadline` (true) or until wake() (false).
+    virtual bool sleepUntil(std::chrono::nanoseconds deadline) = 0;
+    virtual void wake() = 0;
+};
+
+class PiHal final : public Hal {
+public:
+    bool setup() override {
+        return wiringPiSetupGpio() != -1;
+    }
+
+    void pinMode(int pin, int mode) override {
+        ::pinMode(pin, mode);
+    }
+
+    void pullUp(int pin) override {
+        pullUpDnControl(pin, PUD_UP);
+    }
+
+    void digitalWrite(int pin, int value) override {
+        ::digitalWrite(pin, value);
+    }
+
+    void configureOutputs(uint32_t pins) override {
+        for (int pin = 0; pin < 32; ++pin) {
+            if (pins & pinMask(pin)) ::pinMode(pin, OUTPUT);
+        }
+        if (!gpiomem.open()) gpiochip.open(pins);
+    }
+
+    void writePins(uint32_t set_mask, uint32_t clear_mask) override {
+        if (gpiomem.ready()) {
+            gpiomem.write(set_mask, clear_mask);
+        } else if (gpiochip.ready()) {
+            gpiochip.write(set_mask, clear_mask);
+        } else {
+            for (int pin = 0; pin < 32; ++pin) {
+                if (set_mask & pinMask(pin)) ::digitalWrite(pin, HIGH);
+            }
+            for (int pin = 0; pin < 32; ++pin) {
+                if (clear_mask & pinMask(pin)) ::digitalWrite(pin, LOW);
+            }
+        }
+    }
+
+    int digitalRead(int pin) override {
+        return ::digitalRead(pin);
+    }
+
+    bool attachButton(int pin, void (*on_edge)(const ButtonEdge&)) override {
+        edge_callback = on_edge;
+        if (edges.open(pin)) {
+            std::thread([this] {
+                if (edge_thread_setup != nullptr) edge_thread_setup();
+                ButtonEdge edge;
+                while (edges.read(edge)) edge_callback(edge);
+            }).detach();
+            return true;
+        }
+        return wiringPiISR(pin, INT_EDGE_FALLING, &wiringPiEdge) >= 0;
+    }
+
+    I2CBackend* openI2C(int bus) override {
+        return i2c.open(bus) ? &i2c : nullptr;
+    }
+
+    std::chrono::nanoseconds now() override {
+        return EventLoop::now();
+    }
+
+    bool sleepUntil(std::chrono::nanoseconds deadline) override {
+        return loop.waitUntil(deadline);
+    }
+
+    void wake() override {
+        loop.wake();
+    }
+
+    // Runs on the button edge thread before it handles any edge; set before
+    // attachButton().
+    static inline void (*edge_thread_setup)() = nullptr;
+
+private:
+    // wiringPi owns its ISR thread, so the setup runs on the first edge.
+    static void wiringPiEdge() {
+        auto now = EventLoop::now();
+        static thread_local bool set_up = false;
+        if (!set_up && edge_thread_setup != nullptr) edge_thread_setup();
+        set_up = true;
+        edge_callback(ButtonEdge{now, false});
+    }
+
+    static inline void (*edge_callback)(const ButtonEdge&) = nullptr;
+
+    EventLoop loop;
+    GpioEdgeSource edges;
+    LinuxI2CBackend i2c;
+    GpioMemBank gpiomem;
+    GpioChipBank gpiochip;
+};
+
+// Interprets the SH1106 command/data stream into a copy of the panel RAM.
+class SimSH1106 : public I2CBackend {
+public:
+    static constexpr int WIDTH = 132;
+    static constexpr int PAGES = 8;
+
+    SimSH1106() {
+        std::memset(ram, 0, sizeof(ram));
+    }
+
+    bool transfer(i2c_msg* msgs, int count) override {
+        transfers += 1;
+        for (int i = 0; i < count; ++i) {
+            if (msgs[i].len == 0) continue;
+            if (msgs[i].buf[0] == 0x40) {
+                for (int b = 1; b < msgs[i].len; ++b) writeData(msgs[i].buf[b]);
+            } else {
+                for (int b = 1; b < msgs[i].len; ++b) writeCommand(msgs[i].buf[b]);
+            }
+        }
+        return true;
+    }
+
+    bool blank() const {
+        for (int page = 0; page < PAGES; ++page) {
+            for (int col = 0; col < WIDTH; ++col) {
+                if (ram[page][col] != 0) return false;
+            }
+        }
+        return true;
+    }
+
+    uint8_t ram[PAGES][WIDTH];
+    bool display_on = false;
+    uint64_t transfers = 0;
+
+private:
+    void writeCommand(uint8_t cmd) {
+        if (pending_argument) {
+            pending_argument = false;
+            return;
+        }
+        if (cmd <= 0x0F) {
+            col = (col & 0xF0) | cmd;
+        } else if (cmd <= 0x1F) {
+            col = (col & 0x0F) | ((cmd & 0x0F) << 4);
+        } else if (cmd >= 0xB0 && cmd <= 0xB7) {
+            page = cmd - 0xB0;
+        } else if (cmd == 0xAE || cmd == 0xAF) {
+            display_on = cmd == 0xAF;
+        } else if (cmd == 0x81 || cmd == 0xA8 || cmd == 0xAD || cmd == 0xD3 ||
+                   cmd == 0xD5 || cmd == 0xD9 || cmd == 0xDA || cmd == 0xDB) {
+            pending_argument = true;
+        }
+    }
+
+    void writeData(uint8_t value) {
+        if (col < WIDTH) ram[page][col++] = value;
+    }
+
+    int page = 0;
+    int col = 0;
+    bool pending_argument = false;
+};
+
+class SimHal final : public Hal {
+public:
+    static constexpr int PINS = 64;
+
+    SimHal() {
+        std::memset(pins, 0, sizeof(pins));
+        std::memset(modes, 0, sizeof(modes));
+    }
+
+    bool setup() override {
+        return true;
+    }
+
+    void pinMode(int pin, int mode) override {
+        modes[pin] = mode;
+    }
+
+    void pullUp(int pin) override {
+        pins[pin] = HIGH;
+    }
+
+    void digitalWrite(int pin, int value) override {
+        pins[pin] = value ? HIGH : LOW;
+        writes += 1;
+        check();
+    }
+
+    void configureOutputs(uint32_t mask) override {
+        for (int pin = 0; pin < 32; ++pin) {
+            if (mask & pinMask(pin)) modes[pin] = OUTPUT;
+        }
+    }
+
+    void writePins(uint32_t set_mask, uint32_t clear_mask) override {
+        for (int pin = 0; pin < 32; ++pin) {
+            if (set_mask & pinMask(pin)) pins[pin] = HIGH;
+            if (clear_mask & pinMask(pin)) pins[pin] = LOW;
+        }
+        writes += 1;
+        check();
+    }
+
+    int digitalRead(int pin) override {
+        return pins[pin];
+    }
+
+    bool attachButton(int pin, void (*on_edge)(const ButtonEdge&)) override {
+        button_pin = pin;
+        button_edge = on_edge;
+        return true;
+    }
+
+    I2CBackend* openI2C(int) override {
+        return &display;
+    }
+
+    std::chrono::nanoseconds now() override {
+        return clock;
+    }
+
+    bool sleepUntil(std::chrono::nanoseconds deadline) override {
+        return runUntil(deadline);
+    }
+
+    void wake() override {
+        woken = true;
+    }
+
+    void schedule(std::chrono::nanoseconds at, std::function<void()> action) {
+        events.push(Event{at, next_sequence++, std::move(action)});
+    }
+
+    // Runs every scheduled event up to `deadline` and parks the clock there,
+    // unless an event calls wake(): then the clock stops at that event.
+    // Waiting FOREVER with nothing left to run returns false at once.
+    bool runUntil(std::chrono::nanoseconds deadline) {
+        while (!woken && !events.empty() && events.top().at <= deadline) {
+            Event event = events.top();
+            events.pop();
+            if (event.at > clock) clock = event.at;
+            event.action();
+        }
+        if (woken) {
+            woken = false;
+            return false;
+        }
+        if (deadline == EventLoop::FOREVER) return false;
+        if (deadline > clock) clock = deadline;
+        return true;
+    }
+
+    // Falling edge on the button line, delivered inline, followed by
+    // `bounces` more edges `spacing` apart as a worn contact would produce.
+    void pressButton(int bounces = 0, std::chrono::nanoseconds spacing = std::chrono::milliseconds(1)) {
+        if (button_edge == nullptr) return;
+        pins[button_pin] = LOW;
+        button_edge(ButtonEdge{clock, false});
+        for (int i = 1; i <= bounces; ++i) {
+            auto at = clock + i * spacing;
+            schedule(at, [this, at] { button_edge(ButtonEdge{at, false}); });
+        }
+        schedule(clock + (bounces + 1) * spacing, [this] { pins[button_pin] = HIGH; });
+    }
+
+    int pin(int number) const {
+        return pins[number];
+    }
+
+    uint32_t levels() const {
+        uint32_t mask = 0;
+        for (int pin = 0; pin < 32; ++pin) {
+            if (pins[pin]) mask |= pinMask(pin);
+        }
+        return mask;
+    }
+
+    SimSH1106 display;
+    uint64_t writes = 0;
+    // Every output state the pins pass through is checked against `legal`;
+    // states that fail it are counted as glitches.
+    std::function<bool(uint32_t)> legal;
+    uint64_t glitches = 0;
+
+private:
+    void check() {
+        if (legal && !legal(levels())) glitches += 1;
+    }
+
+    struct Event {
+        std::chrono::nanoseconds at;
+        uint64_t sequence;
+        std::function<void()> action;
+
+        bool operator>(const Event& other) const {
+            return at != other.at ? at > other.at : sequence > other.sequence;
+        }
+    };
+
+    int pins[PINS];
+    int modes[PINS];
+    int button_pin = -1;
+    void (*button_edge)(const ButtonEdge&) = nullptr;
+    std::chrono::nanoseconds clock{0};
+    bool woken = false;
+    uint64_t next_sequence = 0;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+};
+
+// wiringPi as the first controllers used it: one digitalWrite per output
+// pin for every phase change.
+class WiringPiPinGpio {
+public:
+    void configure(uint32_t pins) {
+        for (int pin = 0; pin < 32; ++pin) {
+            if (pins & pinMask(pin)) ::pinMode(pin, OUTPUT);
+        }
+    }
+
+    void write(uint32_t set_mask, uint32_t clear_mask) {
+        for (int pin = 0; pin < 32; ++pin) {
+            if (set_mask & pinMask(pin)) ::digitalWrite(pin, HIGH);
+            if (clear_mask & pinMask(pin)) ::digitalWrite(pin, LOW);
+        }
+    }
+};
+
+// Display bus through wiringPiI2C: one register write per command or data
+// byte, nothing batched.
+class WiringPiRegisterBus {
+public:
+    bool open(int address) {
+        fd = wiringPiI2CSetup(address);
+        return fd != -1;
+    }
+
+    void command(uint8_t value) {
+        if (wiringPiI2CWriteReg8(fd, 0x00, value) < 0) failed = true;
+    }
+
+    void data(const uint8_t* bytes, int len) {
+        for (int i = 0; i < len; ++i) {
+            if (wiringPiI2CWriteReg8(fd, 0x40, bytes[i]) < 0) failed = true;
+        }
+    }
+
+    // False if any write since the last submit() failed.
+    bool submit() {
+        bool ok = !failed;
+        failed = false;
+        return ok;
+    }
+
+private:
+    int fd = -1;
+    bool failed = false;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Log-linear histogram of nanosecond values: 32 linear sub-buckets per power
+// of two, so any recorded value is reported within ~3% without storing
+// samples.
+class Histogram {
+public:
+    static constexpr int SUB_BITS = 5;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    Histogram() {
+        reset();
+    }
+
+    void reset() {
+        std::memset(counts, 0, sizeof(counts));
+        total = 0;
+        sum = 0;
+        max = 0;
+    }
+
+    void record(uint64_t value) {
+        counts[bucketOf(value)] += 1;
+        total += 1;
+        sum += value;
+        if (value > max) max = value;
+    }
+
+    void merge(const Histogram& other) {
+        for (int i = 0; i < BUCKETS; ++i) counts[i] += other.counts[i];
+        total += other.total;
+        sum += other.sum;
+        if (other.max > max) max = other.max;
+    }
+
+    // Adds counts kept elsewhere in the same bucket layout.
+    void mergeCounts(const uint64_t* bucket_counts, uint64_t other_sum, uint64_t other_max) {
+        for (int i = 0; i < BUCKETS; ++i) {
+            counts[i] += bucket_counts[i];
+            total += bucket_counts[i];
+        }
+        sum += other_sum;
+        if (other_max > max) max = other_max;
+    }
+
+    uint64_t count() const {
+        return total;
+    }
+
+    uint64_t maximum() const {
+        return max;
+    }
+
+    double mean() const {
+        return total ? double(sum) / double(total) : 0.0;
+    }
+
+    // Upper edge of the bucket holding the p-th percentile (0 < p <= 100).
+    uint64_t percentile(double p) const {
+        if (total == 0) return 0;
+        uint64_t rank = uint64_t(p / 100.0 * double(total) + 0.5);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                if (i + 1 == BUCKETS) return max;
+                uint64_t upper = bucketFloor(i + 1) - 1;
+                return upper < max ? upper : max;
+            }
+        }
+        return max;
+    }
+
+    static int bucketOf(uint64_t value) {
+        if (value < SUB_BUCKETS) return int(value);
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + int((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t bucketFloor(int index) {
+        if (index < SUB_BUCKETS) return uint64_t(index);
+        int shift = index / SUB_BUCKETS - 1;
+        return uint64_t(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    }
+
+private:
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+class I2CBackend {
+public:
+    virtual ~I2CBackend() = default;
+    // Sends every message in one bus transaction; false on bus error.
+    virtual bool transfer(i2c_msg* msgs, int count) = 0;
+};
+
+class LinuxI2CBackend : public I2CBackend {
+public:
+    ~LinuxI2CBackend() override {
+        if (fd >= 0) close(fd);
+    }
+
+    bool open(int bus) {
+        char path[32];
+        std::snprintf(path, sizeof(path), "/dev/i2c-%d", bus);
+        fd = ::open(path, O_RDWR | O_CLOEXEC);
+        return fd >= 0;
+    }
+
+    bool transfer(i2c_msg* msgs, int count) override {
+        i2c_rdwr_ioctl_data request{msgs, static_cast<uint32_t>(count)};
+        return ioctl(fd, I2C_RDWR, &request) >= 0;
+    }
+
+private:
+    int fd = -1;
+};
+
+// Fake bus for trafficBench: keeps every message and counts the syscalls
+// the Linux backend would have made.
+class RecordingI2CBackend : public I2CBackend {
+public:
+    bool transfer(i2c_msg* msgs, int count) override {
+        syscalls += 1;
+        for (int i = 0; i < count; ++i) {
+            messages.emplace_back(msgs[i].buf, msgs[i].buf + msgs[i].len);
+            bytes += msgs[i].len;
+        }
+        return true;
+    }
+
+    void reset() {
+        messages.clear();
+        syscalls = 0;
+        bytes = 0;
+    }
+
+    std::vector<std::vector<uint8_t>> messages;
+    uint64_t syscalls = 0;
+    uint64_t bytes = 0;
+};
+
+struct TransportStats {
+    uint64_t syscalls = 0;
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+};
+
+// Batches SH1106 traffic: consecutive commands share one 0x00-prefixed
+// message, data goes out in 0x40-prefixed blocks of up to a page width, and
+// submit() hands everything queued to the backend in a single transfer.
+class I2CTransport {
+public:
+    static constexpr int MAX_PAYLOAD = 132;
+    static constexpr int MAX_MESSAGES = I2C_RDWR_IOCTL_MAX_MSGS;
+
+    I2CTransport(I2CBackend& backend, uint16_t address) : backend(backend), address(address) {}
+
+    void command(uint8_t cmd) {
+        append(0x00, &cmd, 1);
+    }
+
+    void data(const uint8_t* bytes, int len) {
+        append(0x40, bytes, len);
+    }
+
+    void setCursor(int page, int col) {
+        uint8_t cmds[3] = {
+            static_cast<uint8_t>(0xB0 + page),
+            static_cast<uint8_t>(0x00 + (col & 0x0F)),
+            static_cast<uint8_t>(0x10 + ((col >> 4) & 0x0F)),
+        };
+        append(0x00, cmds, 3);
+    }
+
+    // False if this transfer or one append() sent early, once the batch
+    // was full, failed since the last submit().
+    bool submit() {
+        bool ok = (count == 0 || transfer()) && !failed;
+        failed = false;
+        return ok;
+    }
+
+    const TransportStats& statistics() const {
+        return stats;
+    }
+
+private:
+    bool transfer() {
+        stats.syscalls += 1;
+        stats.messages += count;
+        for (int i = 0; i < count; ++i) stats.bytes += msgs[i].len;
+        bool ok = backend.transfer(msgs, count);
+        if (!ok) stats.errors += 1;
+        count = 0;
+        return ok;
+    }
+
+    void append(uint8_t control, const uint8_t* bytes, int len) {
+        while (len > 0) {
+            if (count == 0 || buffers[count - 1][0] != control || msgs[count - 1].len == MAX_PAYLOAD + 1) {
+                if (count == MAX_MESSAGES && !transfer()) failed = true;
+                buffers[count][0] = control;
+                msgs[count].addr = address;
+                msgs[count].flags = 0;
+                msgs[count].len = 1;
+                msgs[count].buf = buffers[count];
+                ++count;
+            }
+            i2c_msg& msg = msgs[count - 1];
+            int chunk = MAX_PAYLOAD + 1 - msg.len;
+            if (chunk > len) chunk = len;
+            std::memcpy(msg.buf + msg.len, bytes, chunk);
+            msg.len += chunk;
+            bytes += chunk;
+            len -= chunk;
+        }
+    }
+
+    I2CBackend& backend;
+    uint16_t address;
+    i2c_msg msgs[MAX_MESSAGES];
+    uint8_t buffers[MAX_MESSAGES][MAX_PAYLOAD + 1];
+    int count = 0;
+    bool failed = false;
+    TransportStats stats;
+};
@@ -0,0 +1,362 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "eventLoop.h"
+#include "histogram.h"
+#include "phaseEngine.h"
+#include "trafficController.h"
+#include "trafficPlan.h"
+
+// Clock for a controller driven through poll(): the host sets it before
+// every call. Sleeping just moves it on, so run() on it would be a
+// simulation in virtual time.
+class ManualTiming {
+public:
+    std::chrono::nanoseconds now() {
+        return clock;
+    }
+
+    bool sleepUntil(std::chrono::nanoseconds deadline) {
+        if (deadline > clock) clock = deadline;
+        return true;
+    }
+
+    void wake() {}
+
+    std::chrono::nanoseconds clock{0};
+};
+
+// Holds the outputs as the pins would.
+struct LatchGpio {
+    void configure(uint32_t) {}
+
+    void write(uint32_t set_mask, uint32_t clear_mask) {
+        outputs = (outputs | set_mask) & ~clear_mask;
+    }
+
+    uint32_t outputs = 0;
+};
+
+struct IntersectionEvents : NoEvents {
+    void debounced(std::chrono::nanoseconds) {
+        presses += 1;
+    }
+
+    void sequenceFinished(std::chrono::nanoseconds) {
+        cycles += 1;
+    }
+
+    uint64_t presses = 0;
+    uint64_t cycles = 0;
+};
+
+// One simulated crossing: the same TrafficController the programs run,
+// driven through poll() on its own clock instead of a thread. Pedestrians
+// arrive at random with the given mean gap; step() delivers every press and
+// controller deadline due, each at its own time, and wake() says when the
+// next one is.
+class Intersection {
+public:
+    using Controller =
+        TrafficController<BoardPins, EventSync, ManualTiming, LatchGpio, NullDisplay, IntersectionEvents>;
+
+    Intersection(uint64_t seed, std::chrono::nanoseconds mean_press_gap)
+        : rng(seed * 0x9E3779B97F4A7C15ull + 1), mean_gap(mean_press_gap), controller(timing, gpio, display) {
+        controller.setup();
+        due = controller.poll();
+        next_press = nextPress(std::chrono::nanoseconds(0));
+    }
+
+    Intersection(const Intersection&) = delete;
+    Intersection& operator=(const Intersection&) = delete;
+
+    std::chrono::nanoseconds wake() const {
+        if (!controller.working()) return EventLoop::FOREVER;
+        return std::min(due, next_press);
+    }
+
+    // Returns how many events (presses, phase changes, countdown ticks)
+    // were handled.
+    int step(std::chrono::nanoseconds now) {
+        int events = 0;
+        while (controller.working()) {
+            auto at = std::min(due, next_press);
+            if (at > now) break;
+            timing.clock = at;
+            if (next_press == at) {
+                controller.onButtonEdge(ButtonEdge{at, false});
+                next_press = nextPress(next_press);
+                ++arrivals;
+            }
+            due = controller.poll();
+            ++events;
+        }
+        return events;
+    }
+
+    uint32_t outputs() const {
+        return gpio.outputs;
+    }
+
+    uint64_t cycles() const {
+        return controller.events.cycles;
+    }
+
+    uint64_t arrivals = 0;
+
+private:
+    std::chrono::nanoseconds nextPress(std::chrono::nanoseconds after) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        double uniform = double((rng >> 11) + 1) / double(1ull << 53);
+        return after + std::chrono::nanoseconds(int64_t(-std::log(uniform) * double(mean_gap.count())));
+    }
+
+    uint64_t rng;
+    std::chrono::nanoseconds mean_gap;
+    std::chrono::nanoseconds next_press;
+    std::chrono::nanoseconds due;
+    ManualTiming timing;
+    LatchGpio gpio;
+    NullDisplay display;
+    Controller controller;
+};
+
+// Bounded Chase-Lev deque: the owning worker pushes and pops at the bottom,
+// idle workers steal from the top.
+template <class T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t min_capacity) {
+        capacity = 1;
+        while (capacity < min_capacity) capacity <<= 1;
+        slots.reset(new std::atomic<T*>[capacity]);
+    }
+
+    bool push(T* item) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if (b - t >= int64_t(capacity)) return false;
+        slots[b & (capacity - 1)].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    T* pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = slots[b & (capacity - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    T* steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+        T* item = slots[t & (capacity - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    size_t capacity;
+    std::unique_ptr<std::atomic<T*>[]> slots;
+};
+
+class SpinBarrier {
+public:
+    explicit SpinBarrier(int parties) : parties(parties) {}
+
+    void wait() {
+        int generation = phase.load(std::memory_order_acquire);
+        if (arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == parties) {
+            arrived.store(0, std::memory_order_relaxed);
+            phase.store(generation + 1, std::memory_order_release);
+            return;
+        }
+        while (phase.load(std::memory_order_acquire) == generation) std::this_thread::yield();
+    }
+
+private:
+    const int parties;
+    std::atomic<int> arrived{0};
+    std::atomic<int> phase{0};
+};
+
+struct RuntimeReport {
+    uint64_t events = 0;
+    uint64_t steps = 0;
+    uint64_t steals = 0;
+    double wall_seconds = 0;
+    Histogram latency;
+};
+
+// Hosts many Intersections on a fixed pool of workers. Time advances in
+// quanta: every instance due in the current quantum is released onto the
+// deque of the worker that last ran it, workers drain their own deque and
+// steal from the others, then all meet at a barrier. In virtual mode the
+// clock jumps straight to the next due instance; in real-time mode workers
+// sleep until it. Instance times count from the start of run(). Scheduling
+// latency is the wall time from a quantum's release (or the instance's
+// deadline, in real time) to its step() call.
+class IntersectionRuntime {
+public:
+    IntersectionRuntime(size_t workers, size_t max_instances, std::chrono::nanoseconds quantum, bool real_time)
+        : quantum(quantum), real_time(real_time), barrier(int(workers)) {
+        for (size_t i = 0; i < workers; ++i) pool.emplace_back(new Worker(max_instances, i));
+    }
+
+    void add(Intersection* instance) {
+        Worker& worker = *pool[next_worker++ % pool.size()];
+        worker.timers.push_back(Timer{instance->wake(), instance});
+        std::push_heap(worker.timers.begin(), worker.timers.end());
+    }
+
+    RuntimeReport run(std::chrono::nanoseconds duration) {
+        epoch = EventLoop::now();
+        end = duration;
+        auto wall_start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < pool.size(); ++i) threads.emplace_back([this, i] { work(*pool[i]); });
+        work(*pool[0]);
+        for (auto& thread : threads) thread.join();
+
+        RuntimeReport report;
+        report.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+        report.steps = steps;
+        for (auto& worker : pool) {
+            report.events += worker->events;
+            report.steals += worker->steals;
+            report.latency.merge(worker->latency);
+        }
+        return report;
+    }
+
+private:
+    struct Timer {
+        std::chrono::nanoseconds at;
+        Intersection* instance;
+
+        bool operator<(const Timer& other) const {
+            return at > other.at;
+        }
+    };
+
+    struct Worker {
+        Worker(size_t capacity, size_t index) : queue(capacity), rng(index * 2654435761u + 1) {}
+
+        WorkStealingDeque<Intersection> queue;
+        std::vector<Timer> timers;
+        uint32_t rng;
+        uint64_t events = 0;
+        uint64_t steals = 0;
+        Histogram latency;
+    };
+
+    void work(Worker& self) {
+        while (true) {
+            barrier.wait();
+            if (&self == pool[0].get()) plan();
+            barrier.wait();
+            if (finished) return;
+
+            // An instance that finds the deque full stays in the heap, still
+            // due, so plan() starts the next round at the same time for it.
+            int released = 0;
+            while (!self.timers.empty() && self.timers.front().at <= now) {
+                if (!self.queue.push(self.timers.front().instance)) break;
+                std::pop_heap(self.timers.begin(), self.timers.end());
+                self.timers.pop_back();
+                ++released;
+            }
+            outstanding.fetch_add(released, std::memory_order_relaxed);
+            barrier.wait();
+
+            while (outstanding.load(std::memory_order_acquire) > 0) {
+                Intersection* instance = self.queue.pop();
+                if (instance == nullptr) instance = stealFor(self);
+                if (instance == nullptr) continue;
+
+                auto started = EventLoop::now() - epoch;
+                auto due = real_time ? instance->wake() : release;
+                self.latency.record(started > due ? uint64_t((started - due).count()) : 0);
+                self.events += instance->step(now);
+                auto next = instance->wake();
+                if (next != EventLoop::FOREVER) {
+                    self.timers.push_back(Timer{next, instance});
+                    std::push_heap(self.timers.begin(), self.timers.end());
+                }
+                outstanding.fetch_sub(1, std::memory_order_acq_rel);
+            }
+        }
+    }
+
+    Intersection* stealFor(Worker& self) {
+        if (pool.size() == 1) return nullptr;
+        self.rng = self.rng * 1664525u + 1013904223u;
+        Worker& victim = *pool[self.rng % pool.size()];
+        if (&victim == &self) return nullptr;
+        Intersection* instance = victim.queue.steal();
+        if (instance != nullptr) ++self.steals;
+        return instance;
+    }
+
+    // Runs on worker 0 while everybody else waits at the barrier.
+    void plan() {
+        auto next = EventLoop::FOREVER;
+        for (auto& worker : pool) {
+            if (!worker->timers.empty() && worker->timers.front().at < next) next = worker->timers.front().at;
+        }
+        if (next == EventLoop::FOREVER || next > end) {
+            finished = true;
+            return;
+        }
+        // Round up to the quantum so everything due close together is
+        // released in one batch.
+        now = (next + quantum - std::chrono::nanoseconds(1)) / quantum * quantum;
+        if (real_time) sleeper.waitUntil(epoch + now);
+        release = EventLoop::now() - epoch;
+        ++steps;
+    }
+
+    std::chrono::nanoseconds quantum;
+    bool real_time;
+    std::vector<std::unique_ptr<Worker>> pool;
+    size_t next_worker = 0;
+    SpinBarrier barrier;
+    EventLoop sleeper;
+    std::atomic<int64_t> outstanding{0};
+    std::chrono::nanoseconds epoch{0};
+    std::chrono::nanoseconds end{0};
+    std::chrono::nanoseconds now{0};
+    std::chrono::nanoseconds release{0};
+    uint64_t steps = 0;
+    bool finished = false;
+};
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+// Watches the operational state of a set of interfaces. With netlink the
+// thread sleeps until the kernel reports an RTM_NEWLINK/RTM_DELLINK; without
+// it, operstate is re-read from sysfs through descriptors kept open.
+class LinkMonitor {
+public:
+    // Called from run() for every change of a watched interface.
+    using Callback = std::function<void(const std::string& iface, bool up)>;
+
+    explicit LinkMonitor(std::vector<std::string> names) {
+        for (auto& name : names) links.push_back(Link{std::move(name), false, -1});
+        wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    }
+
+    ~LinkMonitor() {
+        for (auto& link : links) {
+            if (link.sysfs_fd >= 0) close(link.sysfs_fd);
+        }
+        if (netlink_fd >= 0) close(netlink_fd);
+        if (wake_fd >= 0) close(wake_fd);
+    }
+
+    bool openNetlink() {
+        int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+        if (fd < 0) return false;
+        sockaddr_nl addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = RTMGRP_LINK;
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            close(fd);
+            return false;
+        }
+        attach(fd);
+        return true;
+    }
+
+    // Takes over any datagram socket that delivers rtnetlink messages; a
+    // socketpair end stands in for the kernel in tests.
+    void attach(int fd) {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+        netlink_fd = fd;
+    }
+
+    // Reads the current state of every interface from sysfs once.
+    void refresh() {
+        for (auto& link : links) link.up = readSysfs(link);
+    }
+
+    bool up(const std::string& name) const {
+        for (auto& link : links) {
+            if (link.name == name) return link.up;
+        }
+        return false;
+    }
+
+    bool anyUp() const {
+        for (auto& link : links) {
+            if (link.up) return true;
+        }
+        return false;
+    }
+
+    // Blocks until stop(), calling back on every change. Falls back to sysfs
+    // polling at poll_interval when no netlink socket is attached.
+    void run(const Callback& callback, std::chrono::milliseconds poll_interval = std::chrono::seconds(1)) {
+        pollfd fds[2] = {{wake_fd, POLLIN, 0}, {netlink_fd, POLLIN, 0}};
+        int count = netlink_fd >= 0 ? 2 : 1;
+        int timeout = netlink_fd >= 0 ? -1 : static_cast<int>(poll_interval.count());
+        while (true) {
+            int ready = poll(fds, count, timeout);
+            if (ready < 0 && errno != EINTR) return;
+            if (fds[0].revents & POLLIN) return;
+            if (netlink_fd >= 0) {
+                if (fds[1].revents & POLLIN) receive(callback);
+            } else {
+                resync(callback, now());
+            }
+        }
+    }
+
+    // Safe to call from a signal handler.
+    void stop() {
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    // Monotonic time the last reported change was received: the socket's
+    // SO_TIMESTAMPNS when it has one (rtnetlink does not), otherwise the
+    // moment recvmsg() or the sysfs read returned. Latency runs from there to
+    // the callback.
+    std::chrono::nanoseconds last_detected{0};
+    uint64_t detections = 0;
+    std::chrono::nanoseconds last_latency{0};
+    std::chrono::nanoseconds max_latency{0};
+    // ENOBUFS: notifications the kernel dropped, recovered from sysfs.
+    uint64_t overruns = 0;
+
+    static std::chrono::nanoseconds now() {
+        return std::chrono::steady_clock::now().time_since_epoch();
+    }
+
+private:
+    // IF_OPER_UP from <linux/if.h>, which cannot be included next to <net/if.h>.
+    static constexpr int OPER_UP = 6;
+
+    struct Link {
+        std::string name;
+        bool up;
+        int sysfs_fd;
+    };
+
+    bool readSysfs(Link& link) {
+        if (link.sysfs_fd < 0) {
+            std::string path = "/sys/class/net/" + link.name + "/operstate";
+            link.sysfs_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (link.sysfs_fd < 0) return false;
+        }
+        char state[16];
+        ssize_t len = pread(link.sysfs_fd, state, sizeof(state), 0);
+        return len >= 2 && std::strncmp(state, "up", 2) == 0;
+    }
+
+    void receive(const Callback& callback) {
+        alignas(nlmsghdr) char buffer[8192];
+        char control[CMSG_SPACE(sizeof(timespec))];
+        iovec iov{buffer, sizeof(buffer)};
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t len = recvmsg(netlink_fd, &msg, MSG_DONTWAIT);
+        std::chrono::nanoseconds received = now();
+        if (len < 0 && errno == ENOBUFS) {
+            // The socket overflowed and changes were lost; sysfs still has
+            // the current state.
+            overruns += 1;
+            resync(callback, received);
+            return;
+        }
+        if (len <= 0) return;
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                timespec stamped, wall;
+                std::memcpy(&stamped, CMSG_DATA(cmsg), sizeof(stamped));
+                clock_gettime(CLOCK_REALTIME, &wall);
+                auto queued = std::chrono::seconds(wall.tv_sec - stamped.tv_sec) +
+                              std::chrono::nanoseconds(wall.tv_nsec - stamped.tv_nsec);
+                if (queued > std::chrono::nanoseconds(0)) received -= queued;
+            }
+        }
+
+        for (nlmsghdr* nh = reinterpret_cast<nlmsghdr*>(buffer); NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type != RTM_NEWLINK && nh->nlmsg_type != RTM_DELLINK) continue;
+            ifinfomsg* info = static_cast<ifinfomsg*>(NLMSG_DATA(nh));
+            const char* name = nullptr;
+            int operstate = -1;
+            int attr_len = IFLA_PAYLOAD(nh);
+            for (rtattr* attr = IFLA_RTA(info); RTA_OK(attr, attr_len); attr = RTA_NEXT(attr, attr_len)) {
+                if (attr->rta_type == IFLA_IFNAME) name = static_cast<const char*>(RTA_DATA(attr));
+                if (attr->rta_type == IFLA_OPERSTATE) operstate = *static_cast<uint8_t*>(RTA_DATA(attr));
+            }
+            if (name == nullptr) continue;
+
+            bool up;
+            if (nh->nlmsg_type == RTM_DELLINK) {
+                up = false;
+            } else if (operstate >= 0) {
+                up = operstate == OPER_UP;
+            } else {
+                up = (info->ifi_flags & IFF_RUNNING) != 0;
+            }
+
+            for (auto& link : links) {
+                if (link.name == name && link.up != up) report(link, up, received, callback);
+            }
+        }
+    }
+
+    void resync(const Callback& callback, std::chrono::nanoseconds received) {
+        for (auto& link : links) {
+            bool up = readSysfs(link);
+            if (up != link.up) report(link, up, received, callback);
+        }
+    }
+
+    void report(Link& link, bool up, std::chrono::nanoseconds received, const Callback& callback) {
+        link.up = up;
+        last_detected = received;
+        last_latency = now() - received;
+        if (last_latency > max_latency) max_latency = last_latency;
+        detections += 1;
+        callback(link.name, up);
+    }
+
+    std::vector<Link> links;
+    int netlink_fd = -1;
+    int wake_fd = -1;
+};
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "eventLoop.h"
+#include "histogram.h"
+
+// Build with -DTRAFFIC_METRICS=0 to compile every record(), add() and
+// metricsNow() down to nothing.
+#ifndef TRAFFIC_METRICS
+#define TRAFFIC_METRICS 1
+#endif
+
+constexpr bool METRICS_ENABLED = TRAFFIC_METRICS != 0;
+
+inline std::chrono::nanoseconds metricsNow() {
+    if constexpr (METRICS_ENABLED) return EventLoop::now();
+    return std::chrono::nanoseconds(0);
+}
+
+// Every metric is a global that links itself into one list when it is
+// constructed, before any thread starts; exporting walks the list.
+class Metric {
+public:
+    Metric(const char* name, const char* help) : name(name), help(help), next(first) {
+        first = this;
+    }
+
+    virtual ~Metric() = default;
+    virtual void write(std::string& out) const = 0;
+
+    static void writeAll(std::string& out) {
+        if constexpr (!METRICS_ENABLED) return;
+        for (const Metric* metric = first; metric != nullptr; metric = metric->next) metric->write(out);
+    }
+
+protected:
+    void header(std::string& out, const char* type) const {
+        out += "# HELP ";
+        out += name;
+        out += ' ';
+        out += help;
+        out += "\n# TYPE ";
+        out += name;
+        out += ' ';
+        out += type;
+        out += '\n';
+    }
+
+    void sample(std::string& out, const char* suffix, const char* labels, double value) const {
+        char line[160];
+        snprintf(line, sizeof(line), "%s%s%s %.9g\n", name, suffix, labels, value);
+        out += line;
+    }
+
+    const char* name;
+    const char* help;
+
+private:
+    static inline Metric* first = nullptr;
+    const Metric* next;
+};
+
+class Counter : public Metric {
+public:
+    using Metric::Metric;
+
+    void add(uint64_t n = 1) {
+        if constexpr (METRICS_ENABLED) value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void write(std::string& out) const override {
+        header(out, "counter");
+        sample(out, "", "", double(value.load(std::memory_order_relaxed)));
+    }
+
+private:
+    std::atomic<uint64_t> value{0};
+};
+
+// Exports a count some other component already keeps.
+class CounterView : public Metric {
+public:
+    CounterView(const char* name, const char* help, uint64_t (*read)()) : Metric(name, help), read(read) {}
+
+    void write(std::string& out) const override {
+        header(out, "counter");
+        sample(out, "", "", double(read()));
+    }
+
+private:
+    uint64_t (*read)();
+};
+
+// Histogram's bucket layout with atomic counts: record() is two relaxed
+// adds, plus a compare-exchange when a new maximum shows up. Exported as a
+// Prometheus summary in seconds.
+class LatencyHistogram : public Metric {
+public:
+    using Metric::Metric;
+
+    void record(std::chrono::nanoseconds value) {
+        if constexpr (!METRICS_ENABLED) return;
+        uint64_t ns = value.count() > 0 ? uint64_t(value.count()) : 0;
+        counts[Histogram::bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t seen = max.load(std::memory_order_relaxed);
+        while (ns > seen && !max.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    void snapshot(Histogram& out) const {
+        uint64_t copy[Histogram::BUCKETS];
+        for (int i = 0; i < Histogram::BUCKETS; ++i) copy[i] = counts[i].load(std::memory_order_relaxed);
+        out.reset();
+        out.mergeCounts(copy, sum.load(std::memory_order_relaxed), max.load(std::memory_order_relaxed));
+    }
+
+    void write(std::string& out) const override {
+        Histogram histogram;
+        snapshot(histogram);
+        header(out, "summary");
+        sample(out, "", "{quantile=\"0.5\"}", histogram.percentile(50) / 1e9);
+        sample(out, "", "{quantile=\"0.99\"}", histogram.percentile(99) / 1e9);
+        sample(out, "", "{quantile=\"0.999\"}", histogram.percentile(99.9) / 1e9);
+        sample(out, "", "{quantile=\"1\"}", histogram.maximum() / 1e9);
+        sample(out, "_sum", "", sum.load(std::memory_order_relaxed) / 1e9);
+        sample(out, "_count", "", double(histogram.count()));
+    }
+
+private:
+    std::atomic<uint64_t> counts[Histogram::BUCKETS] = {};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+};
+
+// Writes the metrics in Prometheus text format to a file every interval
+// (replaced atomically, for node_exporter's textfile collector) and to
+// anyone who connects to a Unix socket.
+class MetricsExporter {
+public:
+    MetricsExporter() {
+        wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    }
+
+    ~MetricsExporter() {
+        if (listen_fd >= 0) {
+            close(listen_fd);
+            unlink(socket_path.c_str());
+        }
+        if (wake_fd >= 0) close(wake_fd);
+    }
+
+    void writeFile(const char* path) {
+        file_path = path;
+    }
+
+    bool listen(const char* path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path) >= int(sizeof(addr.sun_path))) return false;
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd < 0) return false;
+        unlink(path);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(fd, 4) < 0) {
+            close(fd);
+            return false;
+        }
+        listen_fd = fd;
+        socket_path = path;
+        return true;
+    }
+
+    // Blocks until stop().
+    void run(std::chrono::milliseconds interval = std::chrono::seconds(10)) {
+        pollfd fds[2] = {{wake_fd, POLLIN, 0}, {listen_fd, POLLIN, 0}};
+        int count = listen_fd >= 0 ? 2 : 1;
+        auto next_write = EventLoop::now();
+        while (true) {
+            auto now = EventLoop::now();
+            if (!file_path.empty() && now >= next_write) {
+                writeFileNow();
+                next_write = now + interval;
+            }
+            int timeout = file_path.empty()
+                              ? -1
+                              : int(std::chrono::duration_cast<std::chrono::milliseconds>(next_write - now).count()) + 1;
+            int ready = poll(fds, count, timeout);
+            if (ready < 0 && errno != EINTR) return;
+            if (fds[0].revents & POLLIN) break;
+            if (count == 2 && (fds[1].revents & POLLIN)) serve();
+        }
+        if (!file_path.empty()) writeFileNow();
+    }
+
+    // Safe to call from a signal handler.
+    void stop() {
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+private:
+    void writeFileNow() {
+        text.clear();
+        Metric::writeAll(text);
+        std::string temporary = file_path + ".tmp";
+        FILE* file = fopen(temporary.c_str(), "w");
+        if (file == nullptr) return;
+        bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+        ok = fclose(file) == 0 && ok;
+        if (ok) rename(temporary.c_str(), file_path.c_str());
+    }
+
+    void serve() {
+        while (true) {
+            int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) return;
+            text.clear();
+            Metric::writeAll(text);
+            size_t sent = 0;
+            while (sent < text.size()) {
+                ssize_t n = send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0) break;
+                sent += size_t(n);
+            }
+            close(client);
+        }
+    }
+
+    int wake_fd = -1;
+    int listen_fd = -1;
+    std::string socket_path;
+    std::string file_path;
+    std::string text;
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// One row of a signal plan: which outputs are on and for how long. A
+// countdown phase shows `seconds` down to 0, one number per second, so it
+// lasts seconds + 1.
+struct Phase {
+    uint32_t outputs;
+    uint16_t seconds;
+    bool countdown;
+
+    constexpr std::chrono::seconds duration() const {
+        return std::chrono::seconds(seconds + (countdown ? 1 : 0));
+    }
+};
+
+// A plan runs its phases in order and then returns to `rest`, the state the
+// intersection holds between pedestrian requests.
+struct PhasePlan {
+    const Phase* phases;
+    size_t count;
+    uint32_t rest;
+
+    constexpr uint32_t outputsAt(size_t index) const {
+        return index < count ? phases[index].outputs : rest;
+    }
+};
+
+// Which output bits belong to which signal head.
+struct SignalLayout {
+    uint32_t car_green;
+    uint32_t car_yellow;
+    uint32_t car_red;
+    uint32_t ped_green;
+    uint32_t ped_red;
+};
+
+constexpr bool greensNeverTogether(const PhasePlan& plan, const SignalLayout& layout) {
+    for (size_t i = 0; i <= plan.count; ++i) {
+        uint32_t outputs = plan.outputsAt(i);
+        if ((outputs & layout.car_green) && (outputs & layout.ped_green)) return false;
+        if ((outputs & layout.ped_green) && !(outputs & layout.car_red)) return false;
+    }
+    return true;
+}
+
+// `from` is what the outputs show before the plan starts; normally the rest
+// state, since plans run from rest back to rest.
+constexpr bool yellowBetweenGreenAndRed(const PhasePlan& plan, const SignalLayout& layout, uint32_t from) {
+    uint32_t previous = from;
+    for (size_t i = 0; i <= plan.count; ++i) {
+        uint32_t next = plan.outputsAt(i);
+        if ((previous & layout.car_green) && (next & layout.car_red)) return false;
+        if ((previous & layout.car_red) && (next & layout.car_green)) return false;
+        previous = next;
+    }
+    return true;
+}
+
+constexpr bool yellowBetweenGreenAndRed(const PhasePlan& plan, const SignalLayout& layout) {
+    return yellowBetweenGreenAndRed(plan, layout, plan.rest);
+}
+
+constexpr bool everyHeadLit(const PhasePlan& plan, const SignalLayout& layout) {
+    for (size_t i = 0; i <= plan.count; ++i) {
+        uint32_t outputs = plan.outputsAt(i);
+        if (!(outputs & (layout.car_green | layout.car_yellow | layout.car_red))) return false;
+        if (!(outputs & (layout.ped_green | layout.ped_red))) return false;
+    }
+    return true;
+}
+
+constexpr bool validPlan(const PhasePlan& plan, const SignalLayout& layout) {
+    if (plan.count == 0) return false;
+    for (size_t i = 0; i < plan.count; ++i) {
+        if (plan.phases[i].seconds == 0) return false;
+    }
+    return greensNeverTogether(plan, layout) && yellowBetweenGreenAndRed(plan, layout) &&
+           everyHeadLit(plan, layout);
+}
+
+// Steps through a plan against absolute deadlines. The owner sleeps until
+// deadline(), calls advance() and reacts to what it returns; stopping
+// between any two steps is just not calling advance() again.
+class PhaseEngine {
+public:
+    enum Step { PHASE, TICK, DONE };
+
+    // `head_start` is how long the intersection has already been showing
+    // the first phase's outputs (normally the rest state); that much of the
+    // first phase counts as served. Countdown phases are never shortened.
+    void start(const PhasePlan& next, std::chrono::nanoseconds now,
+               std::chrono::nanoseconds head_start = std::chrono::nanoseconds(0)) {
+        plan = &next;
+        index = 0;
+        tick = 0;
+        phase_start = now;
+        if (!phase().countdown && phase().outputs == next.rest && head_start > std::chrono::nanoseconds(0)) {
+            phase_start -= head_start < phase().duration() ? head_start : std::chrono::nanoseconds(phase().duration());
+        }
+    }
+
+    void stop() {
+        plan = nullptr;
+    }
+
+    bool running() const {
+        return plan != nullptr;
+    }
+
+    bool runs(const PhasePlan& candidate) const {
+        return plan == &candidate;
+    }
+
+    // Continues with `next`, which must have the same phases as the running
+    // plan; the current phase keeps its start and takes its length from
+    // `next`. Meant for phase boundaries, before any tick.
+    void adopt(const PhasePlan& next) {
+        plan = &next;
+    }
+
+    const Phase& phase() const {
+        return plan->phases[index];
+    }
+
+    size_t phaseIndex() const {
+        return index;
+    }
+
+    uint32_t outputs() const {
+        return plan->outputsAt(index);
+    }
+
+    // Number the countdown shows right now.
+    int remaining() const {
+        return phase().seconds - tick;
+    }
+
+    std::chrono::nanoseconds deadline() const {
+        if (phase().countdown) return phase_start + std::chrono::seconds(tick + 1);
+        return phase_start + phase().duration();
+    }
+
+    Step advance() {
+        if (phase().countdown && tick < phase().seconds) {
+            ++tick;
+            return TICK;
+        }
+        phase_start += phase().duration();
+        tick = 0;
+        if (++index == plan->count) {
+            plan = nullptr;
+            return DONE;
+        }
+        return PHASE;
+    }
+
+private:
+    const PhasePlan* plan = nullptr;
+    size_t index = 0;
+    int tick = 0;
+    std::chrono::nanoseconds phase_start{0};
+};
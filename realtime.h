@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT 4
+#endif
+
+// Settings for --realtime. The ISR and controller threads move to SCHED_FIFO
+// on `cpu` (ideally one listed in isolcpus=); every other thread stays off
+// it. cpu < 0 means no pinning.
+struct RealtimeOptions {
+    bool enabled = false;
+    int controller_priority = 80;
+    int isr_priority = 85;
+    int cpu = -1;
+};
+
+// Applies RealtimeOptions and remembers what the kernel granted, so main()
+// can report it. Anything refused is left at the ordinary setting: the
+// controller still runs, just without the guarantees.
+class Realtime {
+public:
+    // The CPU the real-time threads get by default: the last one, if there
+    // is more than one.
+    static int defaultCpu() {
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+        return count > 1 ? int(count - 1) : -1;
+    }
+
+    void configure(const RealtimeOptions& next) {
+        options = next;
+    }
+
+    const RealtimeOptions& settings() const {
+        return options;
+    }
+
+    // Locks what is mapped now and whatever gets faulted in later. With
+    // MCL_ONFAULT the default 8 MiB thread stacks are not locked up front,
+    // only the pages prefaultStack() touches. Under a finite RLIMIT_MEMLOCK
+    // MCL_FUTURE would make every later thread stack fail to map, so an
+    // unprivileged process only locks what is mapped now.
+    bool lockMemory() {
+        if (!options.enabled) return false;
+        rlimit limit;
+        if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_MEMLOCK, &limit);
+        }
+        bool unlimited = geteuid() == 0 || (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY);
+        int flags = unlimited ? MCL_CURRENT | MCL_FUTURE : MCL_CURRENT;
+        if (mlockall(flags | MCL_ONFAULT) == 0 || mlockall(flags) == 0) {
+            memory_locked = true;
+            future_locked = unlimited;
+            return true;
+        }
+        lock_error = errno;
+        return false;
+    }
+
+    // Called from main() before any thread starts: threads inherit the
+    // affinity, so the logger, display, link and metrics threads never land
+    // on the real-time CPU.
+    void leaveRealtimeCpu() {
+        if (!options.enabled || options.cpu < 0) return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int cpu = 0; cpu < count && cpu < CPU_SETSIZE; ++cpu) {
+            if (cpu != options.cpu) CPU_SET(cpu, &set);
+        }
+        if (CPU_COUNT(&set) > 0) sched_setaffinity(0, sizeof(set), &set);
+    }
+
+    // Moves the calling thread onto the real-time CPU under SCHED_FIFO and
+    // faults in its stack. Safe to call from any thread, any number of times.
+    bool enter(int priority) {
+        if (!options.enabled) return false;
+        prefaultStack();
+
+        if (options.cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(options.cpu, &set);
+            if (sched_setaffinity(0, sizeof(set), &set) != 0) affinity_error = errno;
+        }
+
+        sched_param param{};
+        param.sched_priority = priority;
+        int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (result != 0) {
+            sched_error = result;
+            refused.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        granted.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool enterController() {
+        return enter(options.controller_priority);
+    }
+
+    bool enterIsr() {
+        return enter(options.isr_priority);
+    }
+
+    void report(FILE* out) const {
+        if (!options.enabled) return;
+        int sched = sched_error.load();
+        int affinity = affinity_error.load();
+        fprintf(out, "Реално време: SCHED_FIFO %d/%d, CPU %d, %d нишки приети, %d отказани%s%s\n",
+                options.controller_priority, options.isr_priority, options.cpu, granted.load(), refused.load(),
+                sched != 0 ? " - " : "", sched != 0 ? std::strerror(sched) : "");
+        if (options.cpu >= 0 && affinity != 0) {
+            fprintf(out, "  закрепване към CPU %d: %s\n", options.cpu, std::strerror(affinity));
+        }
+        fprintf(out, "  заключена памет: %s\n",
+                !memory_locked ? std::strerror(lock_error) : future_locked ? "да" : "само заредената (RLIMIT_MEMLOCK)");
+    }
+
+    bool memory_locked = false;
+    bool future_locked = false;
+
+private:
+    // Touches STACK_BYTES below the current frame so the first deep call on
+    // a real-time path does not page-fault.
+    static constexpr size_t STACK_BYTES = 64 * 1024;
+
+    static void prefaultStack() {
+        volatile unsigned char stack[STACK_BYTES];
+        for (size_t i = 0; i < STACK_BYTES; i += 4096) stack[i] = 0;
+        (void)stack[0];
+    }
+
+    RealtimeOptions options;
+    std::atomic<int> granted{0};
+    std::atomic<int> refused{0};
+    std::atomic<int> sched_error{0};
+    std::atomic<int> affinity_error{0};
+    int lock_error = 0;
+};
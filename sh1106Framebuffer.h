@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+struct BusStats {
+    uint64_t transactions = 0;
+    uint64_t bytes = 0;
+};
+
+// Stands in for the display bus: counts what a flush would put on the wire,
+// one register write (control byte + value) per command or data byte.
+class MockBus {
+public:
+    void command(uint8_t) {
+        stats.transactions += 1;
+        stats.bytes += 2;
+    }
+
+    void data(const uint8_t*, int len) {
+        stats.transactions += len;
+        stats.bytes += 2 * len;
+    }
+
+    bool submit() {
+        return true;
+    }
+
+    BusStats stats;
+};
+
+// 132x64 1bpp copy of the SH1106 RAM. Drawing only touches memory; flush()
+// sends the column ranges of each page that differ from what the panel holds.
+class SH1106Framebuffer {
+public:
+    static constexpr int WIDTH = 132;
+    static constexpr int PAGES = 8;
+
+    SH1106Framebuffer() {
+        std::memset(ram, 0, sizeof(ram));
+        invalidate();
+    }
+
+    void clear() {
+        fill(0, PAGES, 0, WIDTH, 0x00);
+    }
+
+    void fill(int page_begin, int page_end, int col_begin, int col_end, uint8_t value) {
+        uint8_t row[WIDTH];
+        std::memset(row, value, sizeof(row));
+        for (int page = page_begin; page < page_end; ++page) blit(page, col_begin, row, col_end - col_begin);
+    }
+
+    void set(int page, int col, uint8_t value) {
+        if (page < 0 || page >= PAGES || col < 0 || col >= WIDTH) return;
+        if (ram[page][col] == value) return;
+        ram[page][col] = value;
+        markDirty(page, col, col + 1);
+    }
+
+    // Copies a run of columns into one page. The run is compared eight bytes
+    // at a time and only the span between the first and last changed byte is
+    // copied and marked dirty.
+    void blit(int page, int col, const uint8_t* bytes, int len) {
+        if (page < 0 || page >= PAGES) return;
+        if (col < 0) {
+            bytes -= col;
+            len += col;
+            col = 0;
+        }
+        if (col + len > WIDTH) len = WIDTH - col;
+        if (len <= 0) return;
+
+        uint8_t* row = &ram[page][col];
+        int first = -1;
+        int last = -1;
+        int i = 0;
+        for (; i + 8 <= len; i += 8) {
+            uint64_t have, want;
+            std::memcpy(&have, row + i, 8);
+            std::memcpy(&want, bytes + i, 8);
+            uint64_t diff = have ^ want;
+            if (diff == 0) continue;
+            // Little-endian: the lowest set bit belongs to the first byte.
+            if (first < 0) first = i + __builtin_ctzll(diff) / 8;
+            last = i + 7 - __builtin_clzll(diff) / 8;
+        }
+        for (; i < len; ++i) {
+            if (row[i] == bytes[i]) continue;
+            if (first < 0) first = i;
+            last = i;
+        }
+        if (first < 0) return;
+        std::memcpy(row + first, bytes + first, last + 1 - first);
+        markDirty(page, col + first, col + last + 1);
+    }
+
+    uint8_t at(int page, int col) const {
+        return ram[page][col];
+    }
+
+    // The panel contents are unknown (power-up, bus error): the next flush
+    // rewrites every page in full.
+    void invalidate() {
+        panel_known = false;
+        for (int page = 0; page < PAGES; ++page) {
+            dirty_begin[page] = 0;
+            dirty_end[page] = WIDTH;
+        }
+    }
+
+    // The panel is known to hold all zeros (cleared before a clean exit and
+    // not powered off since): drop whatever is drawn and send nothing.
+    void assumeBlank() {
+        std::memset(ram, 0, sizeof(ram));
+        std::memset(panel, 0, sizeof(panel));
+        panel_known = true;
+        for (int page = 0; page < PAGES; ++page) {
+            dirty_begin[page] = WIDTH;
+            dirty_end[page] = 0;
+        }
+    }
+
+    bool dirty() const {
+        for (int page = 0; page < PAGES; ++page) {
+            if (dirty_begin[page] < dirty_end[page]) return true;
+        }
+        return false;
+    }
+
+    // False when the bus reported an error; the panel is then unknown and
+    // the next flush rewrites it in full.
+    template <class Bus>
+    bool flush(Bus& bus) {
+        int cursor_page = -1;
+        int cursor_col = -1;
+        for (int page = 0; page < PAGES; ++page) {
+            int col = dirty_begin[page];
+            int end = dirty_end[page];
+            while (col < end) {
+                if (panel_known && ram[page][col] == panel[page][col]) {
+                    ++col;
+                    continue;
+                }
+                int run_end = col + 1;
+                int last_changed = col;
+                // Moving the cursor costs up to two column commands, so short
+                // gaps of unchanged bytes are cheaper to resend than to skip.
+                while (run_end < end && run_end - last_changed <= 2) {
+                    if (!panel_known || ram[page][run_end] != panel[page][run_end]) last_changed = run_end;
+                    ++run_end;
+                }
+                int len = last_changed + 1 - col;
+                if (page != cursor_page) bus.command(0xB0 + page);
+                if (page != cursor_page || (col & 0x0F) != (cursor_col & 0x0F)) bus.command(0x00 + (col & 0x0F));
+                if (page != cursor_page || (col >> 4) != (cursor_col >> 4)) bus.command(0x10 + ((col >> 4) & 0x0F));
+                bus.data(&ram[page][col], len);
+                std::memcpy(&panel[page][col], &ram[page][col], len);
+                cursor_page = page;
+                cursor_col = col + len;
+                col = last_changed + 1;
+            }
+            dirty_begin[page] = WIDTH;
+            dirty_end[page] = 0;
+        }
+        panel_known = true;
+        if (bus.submit()) return true;
+        invalidate();
+        return false;
+    }
+
+private:
+    void markDirty(int page, int begin, int end) {
+        if (begin < dirty_begin[page]) dirty_begin[page] = begin;
+        if (end > dirty_end[page]) dirty_end[page] = end;
+    }
+
+    uint8_t ram[PAGES][WIDTH];
+    uint8_t panel[PAGES][WIDTH];
+    int dirty_begin[PAGES];
+    int dirty_end[PAGES];
+    bool panel_known = false;
+};
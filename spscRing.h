@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-size single-producer/single-consumer ring. push() never blocks or
+// allocates: when the ring is full the item is dropped and counted.
+template <class T, size_t Capacity>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    bool push(const T& item) {
+        uint64_t head = write_index.load(std::memory_order_relaxed);
+        if (head - read_index.load(std::memory_order_acquire) == Capacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots[head & (Capacity - 1)] = item;
+        write_index.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        uint64_t tail = read_index.load(std::memory_order_relaxed);
+        if (tail == write_index.load(std::memory_order_acquire)) return false;
+        item = slots[tail & (Capacity - 1)];
+        read_index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: nothing left to pop right now.
+    bool empty() const {
+        return read_index.load(std::memory_order_relaxed) == write_index.load(std::memory_order_acquire);
+    }
+
+    uint64_t droppedCount() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    alignas(64) std::atomic<uint64_t> write_index{0};
+    alignas(64) std::atomic<uint64_t> read_index{0};
+    alignas(64) std::atomic<uint64_t> dropped{0};
+    T slots[Capacity];
+};
@@ -2,329 +2,1052 @@
 #include <unistd.h>
 #include <atomic>
 #include <thread>
-#include <mutex>
-#include <condition_variable>
 #include <wiringPi.h>
-#include <wiringPiI2C.h>
 #include <cstdio>
 #include <chrono>
-#include <fstream>
+#include <string>
+#include <vector>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+#include <random>
+#include "sh1106Framebuffer.h"
+#include "glyphFont.h"
+#include "i2cTransport.h"
+#include "hal.h"
+#include "linkMonitor.h"
+#include "trafficPlan.h"
+#include "trafficController.h"
+#include "displayPolicies.h"
+#include "buttonEdges.h"
+#include "spscRing.h"
+#include "histogram.h"
+#include "asyncLog.h"
+#include "tripleBuffer.h"
+#include "metrics.h"
+#include "benchReport.h"
+#include "realtime.h"
+#include "eventTrace.h"
+#include "controlApi.h"
+#include "greenWave.h"
+#include "demandStats.h"
+#include "timingPlans.h"
 
-constexpr int CAR_GREEN      = 17;
-constexpr int CAR_YELLOW     = 27;
-constexpr int CAR_RED        = 22;
-constexpr int PED_RED        = 25;
-constexpr int PED_GREEN      = 16;
-constexpr int BUTTON_PIN     = 26;
-constexpr int BUZZER_PIN     = 21;
 constexpr int SH1106_I2C_ADDR = 0x3C;
+constexpr int I2C_BUS        = 1;
 
-int fd = -1;
+// Left behind by a clean exit once the panel RAM has been cleared; /run is
+// a tmpfs, so a reboot (which also powers the panel off) removes it.
+constexpr const char* DISPLAY_BLANK_MARKER = "/run/trafficLight.display-blank";
 
-bool work = true;
-bool pedestrian_request = false;
-bool timer_running = false;
-bool ethernet_connected = true;
+using namespace std::chrono_literals;
 
-std::mutex mutex;
-std::condition_variable cond;
+ServiceMode service_mode = SERVICE_DEMAND;
+volatile sig_atomic_t interrupted = 0;
 
-void sendCommand(uint8_t cmd) {
-    wiringPiI2CWriteReg8(fd, 0x00, cmd);
+bool verbose = true;
+
+PiHal pi_hal;
+Hal* hal = &pi_hal;
+
+SH1106Framebuffer framebuffer;
+std::unique_ptr<I2CTransport> i2c;
+std::unique_ptr<LinkMonitor> link_monitor;
+
+enum LogEvent : uint32_t {
+    LOG_BUTTON_IGNORED,
+    LOG_BUTTON_PRESSED,
+    LOG_COUNTDOWN,
+    LOG_SEQUENCE_STARTED,
+    LOG_SEQUENCE_FINISHED,
+    LOG_COUNTDOWN_LATENESS,
+    LOG_LINK_UP,
+    LOG_LINK_DOWN,
+    LOG_BUTTON_LATCHED,
+    LOG_BUTTON_SERVED,
+    LOG_PLAN_ADOPTED,
+};
+
+const LogFormat LOG_FORMATS[] = {
+    {"Бутона е вече натиснат или няма мрежа, игнориране.\n", false},
+    {"Бутонът е натиснат, започва пешеходна последователност.\n", false},
+    {"Оставащи секунди: %lld\n", false},
+    {"Стартирана е пешеходна последователност\n", false},
+    {"Пешеходната последователност приключи\n", false},
+    {"Максимално закъснение на отброяването: %lld us\n", false},
+    {"%s свързан!\n", true},
+    {"%s прекъснат!\n", true},
+    {"Заявката е запомнена за следващия цикъл.\n", false},
+    {"Пешеходците ще минат в текущия цикъл.\n", false},
+    {"Светофарът работи по план %s (версия %lld)\n", true},
+};
+
+AsyncLogger logger(LOG_FORMATS, sizeof(LOG_FORMATS) / sizeof(LOG_FORMATS[0]));
+
+template <class... Args>
+void logMessage(LogEvent event, Args... args) {
+    if (!verbose) return;
+    logger.log(event, args...);
+}
+
+LatencyHistogram press_to_sequence("traffic_press_to_sequence_seconds",
+                                   "Button press to the start of the pedestrian sequence");
+LatencyHistogram i2c_transfer("traffic_i2c_transfer_seconds", "One batched I2C transfer to the display");
+LatencyHistogram sleep_overshoot("traffic_sleep_overshoot_seconds", "Wake-up past a phase or countdown deadline");
+LatencyHistogram publish_cost("traffic_display_publish_seconds", "Controller cost of publishing a display snapshot");
+LatencyHistogram link_detection("traffic_link_detection_seconds", "Link notification received to the handler");
+Counter presses_total("traffic_presses_total", "Debounced button presses");
+Counter cycles_total("traffic_pedestrian_cycles_total", "Completed pedestrian sequences");
+CounterView log_dropped("traffic_log_dropped_total", "Log records dropped on full rings",
+                        [] { return logger.dropped(); });
+LatencyHistogram startup_safe_state("traffic_startup_safe_state_seconds", "Start of main() to outputs in the safe state");
+LatencyHistogram startup_display_ready("traffic_startup_display_ready_seconds",
+                                       "Start of main() to the display initialised and cleared");
+MetricsExporter metrics_exporter;
+Realtime realtime;
+
+// --stats: demand counters from the controller, button and control threads,
+// closed into a bucket every wall-clock minute by their own thread.
+DemandStats demand;
+DemandStore demand_store;
+EventLoop stats_loop;
+std::atomic<bool> stats_running(false);
+
+uint32_t wallMinute() {
+    auto wall = std::chrono::system_clock::now().time_since_epoch();
+    return uint32_t(std::chrono::duration_cast<std::chrono::minutes>(wall).count());
+}
+
+void collectDemand() {
+    while (stats_running) {
+        auto wall = std::chrono::system_clock::now().time_since_epoch();
+        auto next = std::chrono::duration_cast<std::chrono::minutes>(wall) + std::chrono::minutes(1);
+        if (stats_loop.waitUntil(EventLoop::now() + (next - wall))) {
+            demand_store.add(demand.collect(uint32_t(next.count() - 1)));
+        }
+    }
+    demand_store.add(demand.collect(wallMinute()));
 }
 
-void sendData(uint8_t data) {
-    wiringPiI2CWriteReg8(fd, 0x40, data);
+// --trace records into `trace`; a replay collects the phases it produces in
+// `replayed_phases` to hold them against the recorded ones.
+TraceRecorder trace;
+std::vector<TraceEvent>* replayed_phases = nullptr;
+
+bool legalLights(uint32_t levels) {
+    Phase state = {levels, 1, false};
+    return validPlan(PhasePlan{&state, 1, levels}, SIGNALS);
+}
+
+void submitDisplay() {
+    auto start = metricsNow();
+    i2c->submit();
+    i2c_transfer.record(metricsNow() - start);
+}
+
+void flushDisplay() {
+    uint64_t syscalls = i2c->statistics().syscalls;
+    auto start = metricsNow();
+    framebuffer.flush(*i2c);
+    if (i2c->statistics().syscalls != syscalls) i2c_transfer.record(metricsNow() - start);
 }
 
 void initDisplay() {
-    sendCommand(0xAE);
-    sendCommand(0xD5); sendCommand(0x80);
-    sendCommand(0xA8); sendCommand(0x3F);
-    sendCommand(0xD3); sendCommand(0x00);
-    sendCommand(0x40);
-    sendCommand(0xAD); sendCommand(0x8B);
-    sendCommand(0xA1);
-    sendCommand(0xC8);
-    sendCommand(0xDA); sendCommand(0x12);
-    sendCommand(0x81); sendCommand(0xCF);
-    sendCommand(0xD9); sendCommand(0xF1);
-    sendCommand(0xDB); sendCommand(0x40);    
-    sendCommand(0xA4);
-    sendCommand(0xA6);
-    sendCommand(0xAF);
+    sendDisplayInit(*i2c);
+    submitDisplay();
 }
 
 void clearDisplay() {
-    for (int page = 0; page < 8; ++page) {
-        sendCommand(0xB0 + page);
-        sendCommand(0x00);
-        sendCommand(0x10);
-        for (int col = 0; col < 132; ++col) {
-            sendData(0x00);
-        }
-    }
+    framebuffer.clear();
+    flushDisplay();
 }
 
 void turnOffDisplay() {
-    sendCommand(0xAE);
+    i2c->command(0xAE);
+    submitDisplay();
 }
 
-void setCursor(int page, int col) {
-    sendCommand(0xB0 + page);
-    sendCommand(0x00 + (col & 0x0F));
-    sendCommand(0x10 + ((col >> 4) & 0x0F));
+TripleBuffer<DisplaySnapshot> display_state;
+EventLoop display_loop;
+std::atomic<bool> display_running(false);
+
+void renderDisplay(const DisplaySnapshot& snapshot) {
+    renderSnapshot(framebuffer, snapshot);
+    flushDisplay();
 }
 
-const uint8_t bigDigits16x8[10][16] = {
-    {0x3C,0x00,0x42,0x00,0x81,0x00,0x81,0x00,0x81,0x00,0x81,0x00,0x42,0x00,0x3C,0x00},
-    {0x00,0x00,0x84,0x00,0xFE,0x00,0x80,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
-    {0xC2,0x00,0xA1,0x00,0x91,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x86,0x00,0x00,0x00},
-    {0x42,0x00,0x81,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x76,0x00,0x00,0x00},
-    {0x30,0x00,0x28,0x00,0x24,0x00,0x22,0x00,0xFE,0x00,0x20,0x00,0x20,0x00,0x00,0x00},
-    {0x4F,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x71,0x00,0x00,0x00},
-    {0x7E,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x72,0x00,0x00,0x00},
-    {0x01,0x00,0xE1,0x00,0x11,0x00,0x09,0x00,0x05,0x00,0x03,0x00,0x01,0x00,0x00,0x00},
-    {0x76,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x76,0x00,0x00,0x00},
-    {0x06,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x89,0x00,0x49,0x00,0x3E,0x00,0x00,0x00}
-};
+bool renderLatest() {
+    DisplaySnapshot snapshot;
+    if (!display_state.take(snapshot)) return false;
+    renderDisplay(snapshot);
+    return true;
+}
+
+std::chrono::nanoseconds boot_start{0};
+
+bool setupDisplay(bool known_blank = false);
 
-void drawBigDigit16x8(int page, int col, int digit) {
-    if (digit < 0 || digit > 9) return;
-    setCursor(page, col);
-    for (int i = 0; i < 8; ++i) sendData(bigDigits16x8[digit][i * 2]);
-    setCursor(page + 1, col);
-    for (int i = 0; i < 8; ++i) sendData(bigDigits16x8[digit][i * 2 + 1]);
+// Brings the display up off the controller's path, then draws whatever the
+// controller published meanwhile. Without a display the lights keep going.
+void displayRenderer() {
+    bool blank = unlink(DISPLAY_BLANK_MARKER) == 0;
+    if (!setupDisplay(blank)) {
+        printf("Грешка при инициализация на дисплея\n");
+        return;
+    }
+    auto ready = EventLoop::now() - boot_start;
+    startup_display_ready.record(ready);
+    printf("Дисплеят е готов след %.1f ms%s\n", ready.count() / 1e6, blank ? " (без изчистване)" : "");
+
+    while (display_running) {
+        display_loop.waitUntil(EventLoop::FOREVER);
+        renderLatest();
+    }
+    renderLatest();
 }
 
-void countdownTimer(int seconds) {
-    digitalWrite(BUZZER_PIN, HIGH);
+bool pedestrianPending();
+void remoteWalkRequest();
 
-    for (int i = seconds; i >= 0 && work && timer_running; --i) {
-        printf("Оставащи секунди: %d\n", i);
-        for (int page = 3; page <= 4; ++page) {
-            setCursor(page, 44);
-            for (int col = 44; col < 60; ++col) sendData(0x00);
+ControlServer control_server(&remoteWalkRequest, &pedestrianPending);
+bool control_enabled = false;
+std::atomic<uint64_t> completed_cycles{0};
+
+// Never touches the bus: with the render thread running this is a slot swap
+// and a wakeup. Without it (simulation) the snapshot is drawn in place. The
+// control API gets the same snapshot the same way.
+struct AppDisplay {
+    void show(const DisplaySnapshot& snapshot) {
+        auto start = metricsNow();
+        display_state.publish(snapshot);
+        if (display_running) {
+            display_loop.wake();
+        } else {
+            renderLatest();
+        }
+        if (control_enabled) {
+            control_server.publish(ControlState{snapshot.phase, snapshot.seconds, snapshot.link, snapshot.phase >= 0,
+                                                completed_cycles.load(std::memory_order_relaxed),
+                                                EventLoop::now().count()});
         }
+        publish_cost.record(metricsNow() - start);
+    }
+};
+
+struct ControllerEvents {
+    void debounced(std::chrono::nanoseconds latency) {
+        press_latency.record(latency.count());
+        presses_total.add();
+        demand.add(DEMAND_PRESSES);
+    }
 
-        int tens = i / 10;
-        int ones = i % 10;
-        drawBigDigit16x8(3, 44, tens);
-        drawBigDigit16x8(3, 52, ones);
+    void buttonIgnored() {
+        ignored_presses += 1;
+        logMessage(LOG_BUTTON_IGNORED);
+        demand.add(DEMAND_IGNORED);
+    }
 
-        for (int ms = 0; ms < 1000 && work && timer_running; ms += 100) {
-            usleep(100 * 1000);
-        }
+    void buttonServed() {
+        logMessage(LOG_BUTTON_SERVED);
+        demand.add(DEMAND_SERVED);
     }
 
-    digitalWrite(BUZZER_PIN, LOW);
-    clearDisplay();
-}
+    void buttonLatched() {
+        logMessage(LOG_BUTTON_LATCHED);
+        demand.add(DEMAND_REQUESTS);
+    }
 
-void pedestrianSequence() {
-    std::printf("Стартирана е пешеходна последователност\n");
+    void buttonPressed() {
+        logMessage(LOG_BUTTON_PRESSED);
+        demand.add(DEMAND_REQUESTS);
+    }
 
-    std::this_thread::sleep_for(std::chrono::seconds(5));
-    if (!work) return;
+    void sequenceStarted(std::chrono::nanoseconds waited) {
+        logMessage(LOG_SEQUENCE_STARTED);
+        press_to_sequence.record(waited);
+    }
 
-    digitalWrite(CAR_GREEN, LOW);
-    digitalWrite(CAR_YELLOW, HIGH);
-    std::this_thread::sleep_for(std::chrono::seconds(2));
-    if (!work) return;
+    void planAdopted(const PlanSnapshot& snapshot) {
+        logMessage(LOG_PLAN_ADOPTED, snapshot.name, (long long)snapshot.generation);
+    }
 
-    digitalWrite(CAR_YELLOW, LOW);
-    digitalWrite(CAR_RED, HIGH);
-    std::this_thread::sleep_for(std::chrono::seconds(2));
-    if (!work) return;
+    void walked(std::chrono::nanoseconds waited) {
+        walk_latency.record(waited.count());
+        demand.wait(waited);
+    }
 
-    digitalWrite(PED_RED, LOW);
-    if (!work) return;
+    void countdown(int seconds) {
+        logMessage(LOG_COUNTDOWN, seconds);
+    }
 
-    digitalWrite(PED_GREEN, HIGH);
+    void overshoot(std::chrono::nanoseconds lateness) {
+        sleep_overshoot.record(lateness);
+    }
 
-    countdownTimer(20);
+    void sequenceFinished(std::chrono::nanoseconds max_lateness) {
+        cycles_total.add();
+        completed_cycles.fetch_add(1, std::memory_order_relaxed);
+        demand.add(DEMAND_CYCLES);
+        logMessage(LOG_SEQUENCE_FINISHED);
+        logMessage(LOG_COUNTDOWN_LATENESS,
+                   (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(max_lateness).count());
+    }
 
-    if (!work) return;
+    void traceEdge(const ButtonEdge& edge) {
+        trace.record(TRACE_EDGE, edge.timestamp, edge.rising);
+    }
 
-    digitalWrite(PED_GREEN, LOW);
-    digitalWrite(PED_RED, HIGH);
-    std::this_thread::sleep_for(std::chrono::seconds(5));
-    if (!work) return;
+    void traceLink(std::chrono::nanoseconds at, bool up) {
+        trace.record(TRACE_LINK, at, up);
+    }
 
-    digitalWrite(CAR_RED, LOW);
-    digitalWrite(CAR_YELLOW, HIGH);
-    std::this_thread::sleep_for(std::chrono::seconds(2));
-    if (!work) return;
-    digitalWrite(CAR_YELLOW, LOW);
-    digitalWrite(CAR_GREEN, HIGH);
+    void traceRequest(std::chrono::nanoseconds at) {
+        trace.record(TRACE_REQUEST, at, 0);
+        demand.add(DEMAND_REMOTE);
+    }
 
-    {
-        std::lock_guard<std::mutex> lock(mutex);
-        pedestrian_request = false;
-        timer_running = false;
+    void tracePhase(std::chrono::nanoseconds at, uint32_t outputs) {
+        trace.record(TRACE_PHASE, at, outputs);
+        if (replayed_phases != nullptr) replayed_phases->push_back(TraceEvent{at, TRACE_PHASE, outputs});
     }
 
-    std::printf("Пешеходната последователност приключи\n");
+    // Edge-to-handling time and press-to-walk time.
+    Histogram press_latency;
+    Histogram walk_latency;
+    uint64_t ignored_presses = 0;
+};
+
+// The same controller on the board and on the simulator; only the HAL type
+// differs, so neither build pays for virtual calls on the hot path.
+template <class H>
+using Controller = TrafficController<BoardPins, EventSync, HalTiming<H>, HalGpio<H>, AppDisplay, ControllerEvents>;
+
+Controller<PiHal>* pi_controller = nullptr;
+Controller<SimHal>* sim_controller = nullptr;
+
+CounterView edges_dropped("traffic_button_edges_dropped_total", "Button edges dropped on a full queue",
+                          [] { return pi_controller != nullptr ? pi_controller->droppedEdges() : uint64_t(0); });
+
+void piButtonEdge(const ButtonEdge& edge) {
+    pi_controller->onButtonEdge(edge);
 }
 
-void trafficLightController() {
-    while (work) {
-        std::unique_lock<std::mutex> lock(mutex);
-        cond.wait(lock, [] { return pedestrian_request || !work; });
-        if (!work) break;
-        pedestrian_request = false;
-        lock.unlock();
+void simButtonEdge(const ButtonEdge& edge) {
+    sim_controller->onButtonEdge(edge);
+}
 
-        pedestrianSequence();
+void remoteWalkRequest() {
+    if (pi_controller != nullptr) pi_controller->requestWalk();
+}
 
-        std::lock_guard<std::mutex> lock2(mutex);
-        if (!ethernet_connected) {
-            work = false;
-            cond.notify_one();
-            break;
-        }
-    }
+bool pedestrianPending() {
+    return pi_controller != nullptr && pi_controller->requestPending();
 }
 
-bool isEthernetUp(const std::string& iface) {
-    std::ifstream f("/sys/class/net/" + iface + "/operstate");
-    if (!f.is_open()) {
-        printf("Cannot open operstate for %s\n", iface.c_str());
-        return false;
-    }
-    std::string state;
-    std::getline(f, state);
-    f.close();
-    return (state == "up");
+void applyServiceWindow(std::chrono::nanoseconds cycle, std::chrono::nanoseconds origin) {
+    if (pi_controller != nullptr) pi_controller->setServiceWindow(ServiceWindow{cycle, origin});
 }
 
-void monitorEthernet() {
-    while (work) {
-        bool connected = isEthernetUp("eth0");
-
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            if (connected != ethernet_connected) {
-                ethernet_connected = connected;
-                if (!ethernet_connected) {
-                    printf("Ethernet прекъснат!\n");
-                } else {
-                    printf("Ethernet свързан!\n");
-                }
-            }
+GreenWave green_wave(&applyServiceWindow);
+bool wave_enabled = false;
 
-            if (!ethernet_connected && !timer_running) {
-                work = false;
-                cond.notify_one();
-                break;
-            }
-        }
+// --plans: the watcher thread publishes, the controller thread reads.
+void reportPlans(const char* message) {
+    printf("%s\n", message);
+}
+
+PlanCell timing_plans;
+PlanWatcher<BoardPins> plan_watcher(timing_plans, &reportPlans);
+bool plans_enabled = false;
 
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+void onLinkChange(const std::string& iface, bool up) {
+    link_detection.record(LinkMonitor::now() - link_monitor->last_detected);
+    logMessage(up ? LOG_LINK_UP : LOG_LINK_DOWN, iface.c_str());
+    pi_controller->setLink(link_monitor->anyUp());
+    if (!pi_controller->working()) link_monitor->stop();
+}
+
+void monitorEthernet() {
+    bool netlink = link_monitor->openNetlink();
+    link_monitor->refresh();
+    if (!link_monitor->anyUp()) {
+        printf("Няма мрежова връзка!\n");
+        pi_controller->stop();
+        return;
+    }
+    if (!netlink) {
+        printf("Netlink не е достъпен, връзката се проверява всяка секунда\n");
     }
+    link_monitor->run(onLinkChange);
 }
 
 void handle_exit(int sig) {
     (void)sig;
-    {
-        std::lock_guard<std::mutex> lock(mutex);
-        work = false;
-    }
-    cond.notify_one();
+    interrupted = 1;
+    if (pi_controller) pi_controller->stop();
+    if (link_monitor) link_monitor->stop();
+    metrics_exporter.stop();
+    control_server.stop();
+    green_wave.stop();
+    plan_watcher.stop();
+    stats_running = false;
+    stats_loop.wake();
+}
 
-    digitalWrite(CAR_GREEN, LOW);
-    digitalWrite(CAR_YELLOW, LOW);
-    digitalWrite(CAR_RED, LOW);
-    digitalWrite(PED_RED, LOW);
-    digitalWrite(PED_GREEN, LOW);
-    digitalWrite(BUZZER_PIN, LOW);
+void setupButton() {
+    hal->pinMode(BUTTON_PIN, INPUT);
+    hal->pullUp(BUTTON_PIN);
+}
 
+// A known-blank panel only needs the init sequence; otherwise the clear is
+// one batched transfer of all eight pages.
+bool setupDisplay(bool known_blank) {
+    I2CBackend* backend = hal->openI2C(I2C_BUS);
+    if (backend == nullptr) return false;
+    i2c.reset(new I2CTransport(*backend, SH1106_I2C_ADDR));
+    initDisplay();
+    if (known_blank) {
+        framebuffer.assumeBlank();
+    } else {
+        framebuffer.invalidate();
+    }
     clearDisplay();
-    turnOffDisplay();
+    return true;
+}
+
+// Presses FIXED ignores during a cycle never get a walk; they count as
+// unserved, so both modes are measured over the same pedestrians.
+struct DemandResult {
+    uint64_t presses;
+    double mean_wait;
+    double p99_wait;
+    uint64_t ignored;
+    uint64_t unserved;
+};
+
+// Runs the controller loop itself on a fresh simulator for `duration` of
+// virtual time, with pedestrians pressing at random `mean_gap` apart on
+// average.
+DemandResult simulateDemand(ServiceMode mode, std::chrono::nanoseconds mean_gap, std::chrono::nanoseconds duration) {
+    SimHal sim;
+    hal = &sim;
+    sim.setup();
+    HalTiming<SimHal> timing(sim);
+    HalGpio<SimHal> gpio(sim);
+    AppDisplay display;
+    Controller<SimHal> controller(timing, gpio, display);
+    sim_controller = &controller;
+    controller.service_mode = mode;
+    controller.setup();
+    setupButton();
+    setupDisplay();
+    sim.attachButton(BUTTON_PIN, &simButtonEdge);
+
+    std::mt19937_64 rng(uint64_t(mean_gap.count()));
+    std::exponential_distribution<double> gap(1.0 / double(mean_gap.count()));
+    uint64_t presses = 0;
+    for (auto at = std::chrono::nanoseconds(int64_t(gap(rng))); at < duration;
+         at += std::chrono::nanoseconds(int64_t(gap(rng)))) {
+        sim.schedule(at, [&sim] { sim.pressButton(); });
+        ++presses;
+    }
+    sim.schedule(duration, [&controller] { controller.stop(); });
 
-    printf("\nСигналът е получен, програмата спира...\n");
+    controller.run();
+    sim_controller = nullptr;
+    const Histogram& walk = controller.events.walk_latency;
+    uint64_t ignored = controller.events.ignored_presses;
+    return DemandResult{presses, walk.mean() / 1e9, walk.percentile(99) / 1e9, ignored,
+                        ignored + controller.waiting_presses.size()};
 }
 
-void buttonISR() {
-    static std::chrono::steady_clock::time_point last_press_time = std::chrono::steady_clock::now() - std::chrono::milliseconds(1000);
-    auto current_time = std::chrono::steady_clock::now();
+int simulate(int cycles) {
+    SimHal sim;
+    hal = &sim;
+    verbose = false;
 
-    if (std::chrono::duration_cast<std::chrono::milliseconds>(current_time - last_press_time).count() < 300) {
-        return;
+    sim.setup();
+    HalTiming<SimHal> timing(sim);
+    HalGpio<SimHal> gpio(sim);
+    AppDisplay display;
+    Controller<SimHal> controller(timing, gpio, display);
+    sim_controller = &controller;
+    controller.service_mode = service_mode;
+    if (plans_enabled) controller.setPlans(&timing_plans);
+    trace.record(TRACE_MODE, sim.now(), service_mode);
+    controller.setup();
+    setupButton();
+    sim.legal = legalLights;
+    setupDisplay();
+    sim.attachButton(BUTTON_PIN, &simButtonEdge);
+    controller.startup();
+
+    auto wall_start = std::chrono::steady_clock::now();
+    int failures = 0;
+    unsigned seed = 1;
+    // --stats: minutes on the virtual clock, counted on from now.
+    uint32_t first_minute = wallMinute();
+    uint32_t open_minute = first_minute;
+    demand.collect(open_minute);
+    for (int cycle = 0; cycle < cycles; ++cycle) {
+        uint32_t minute = first_minute + uint32_t(std::chrono::duration_cast<std::chrono::minutes>(sim.now()).count());
+        if (minute != open_minute) {
+            demand_store.add(demand.collect(open_minute));
+            open_minute = minute;
+        }
+        seed = seed * 1103515245 + 12345;
+        sim.runUntil(sim.now() + std::chrono::milliseconds(500 + (seed >> 8) % 60000));
+        sim.pressButton(8, 500us);
+        while (!sim.runUntil(sim.now() + 10ms)) {
+        }
+        controller.handleButtonEdges();
+        if (!controller.takeRequest()) {
+            ++failures;
+            continue;
+        }
+        controller.pedestrianSequence();
+
+        if (!sim.pin(CAR_GREEN) || sim.pin(CAR_RED) || !sim.pin(PED_RED) ||
+            sim.pin(PED_GREEN) || sim.pin(BUZZER_PIN) || !sim.display.blank()) {
+            ++failures;
+        }
     }
+    auto wall = std::chrono::steady_clock::now() - wall_start;
 
-    last_press_time = current_time;
-    std::lock_guard<std::mutex> lock(mutex);
+    double wall_s = std::chrono::duration<double>(wall).count();
+    double virtual_s = std::chrono::duration<double>(sim.now()).count();
+    printf("Симулация: %d цикъла, %.0f s виртуално време за %.3f s (x%.0f)\n",
+           cycles, virtual_s, wall_s, wall_s > 0 ? virtual_s / wall_s : 0.0);
+    printf("GPIO операции: %llu, междинни забранени състояния: %llu, I2C трансфери: %llu, грешки: %d\n",
+           (unsigned long long)sim.writes, (unsigned long long)sim.glitches,
+           (unsigned long long)sim.display.transfers, failures);
+    printf("Бутон: %llu натискания, %llu отхвърлени отскока, %llu изгубени фронта\n",
+           (unsigned long long)controller.debouncer.accepted,
+           (unsigned long long)controller.debouncer.rejected,
+           (unsigned long long)controller.droppedEdges());
+    sim_controller = nullptr;
+    if (demand_store.active()) {
+        demand_store.add(demand.collect(open_minute));
+        printf("Статистика: %zu минути, %zu четвърт часа, %zu часа\n", demand_store.stored(0), demand_store.stored(1),
+               demand_store.stored(2));
+        demand_store.close();
+    }
+    if (trace.active()) {
+        printf("Трасе: %llu записа, %llu байта\n", (unsigned long long)trace.records, (unsigned long long)trace.bytes);
+        trace.close();
+    }
+    if (failures != 0 || sim.glitches != 0) return 1;
 
-    if (pedestrian_request || timer_running || !ethernet_connected) {
-        printf("Бутона е вече натиснат или няма мрежа, игнориране.\n");
-        return;
+    printf("Време от натискане до зелено за пешеходци (24 h на интервал):\n");
+    printf("%10s %8s %12s %10s %10s %12s %14s\n", "интервал", "режим", "натискания", "средно s", "p99 s",
+           "игнорирани", "необслужени");
+    for (int gap : {600, 120, 60, 30, 10}) {
+        for (ServiceMode mode : {SERVICE_FIXED, SERVICE_DEMAND}) {
+            DemandResult result = simulateDemand(mode, std::chrono::seconds(gap), 24h);
+            printf("%9ds %8s %12llu %10.1f %10.1f %12llu %14llu\n", gap, mode == SERVICE_FIXED ? "fixed" : "demand",
+                   (unsigned long long)result.presses, result.mean_wait, result.p99_wait,
+                   (unsigned long long)result.ignored, (unsigned long long)result.unserved);
+        }
+    }
+    return 0;
+}
+
+// Feeds the button edges and link changes of a recorded trace into a fresh
+// controller on the simulator, at the recorded times on a virtual clock, and
+// compares the phases it sets with the recorded ones. Fails on any phase that
+// differs or drifts by more than `tolerance`.
+int replay(const char* path, std::chrono::nanoseconds tolerance) {
+    std::vector<TraceEvent> events;
+    if (!readTrace(path, events) || events.empty()) {
+        printf("Трасето %s не може да бъде прочетено\n", path);
+        return 1;
     }
 
-    pedestrian_request = true;
-    timer_running = true;
-    cond.notify_one();
+    SimHal sim;
+    hal = &sim;
+    verbose = false;
+    sim.setup();
+    HalTiming<SimHal> timing(sim);
+    HalGpio<SimHal> gpio(sim);
+    AppDisplay display;
+    Controller<SimHal> controller(timing, gpio, display);
+    sim_controller = &controller;
+    if (plans_enabled) controller.setPlans(&timing_plans);
 
-    printf("Бутонът е натиснат, започва пешеходна последователност.\n");
+    auto origin = events.front().at;
+    std::vector<TraceEvent> recorded;
+    uint64_t edges = 0, links = 0;
+    for (const TraceEvent& event : events) {
+        auto at = event.at - origin;
+        switch (event.kind) {
+        case TRACE_EDGE:
+            sim.schedule(at, [&controller, at, event] { controller.onButtonEdge(ButtonEdge{at, event.value != 0}); });
+            ++edges;
+            break;
+        case TRACE_LINK:
+            sim.schedule(at, [&controller, event] { controller.setLink(event.value != 0); });
+            ++links;
+            break;
+        case TRACE_REQUEST:
+            sim.schedule(at, [&controller] { controller.requestWalk(); });
+            break;
+        case TRACE_PHASE:
+            recorded.push_back(TraceEvent{at, TRACE_PHASE, event.value});
+            break;
+        case TRACE_MODE:
+            if (at.count() == 0) controller.service_mode = ServiceMode(event.value);
+            break;
+        default:
+            break;
+        }
+    }
+    auto end = events.back().at - origin + 60s;
+    sim.schedule(end, [&controller] { controller.stop(); });
+
+    std::vector<TraceEvent> produced;
+    replayed_phases = &produced;
+    auto wall_start = std::chrono::steady_clock::now();
+    controller.setup();
+    setupButton();
+    setupDisplay();
+    controller.run();
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    replayed_phases = nullptr;
+    sim_controller = nullptr;
+
+    size_t matched = 0;
+    std::chrono::nanoseconds drift{0};
+    for (; matched < recorded.size() && matched < produced.size(); ++matched) {
+        if (recorded[matched].value != produced[matched].value) break;
+        auto difference = produced[matched].at - recorded[matched].at;
+        if (difference < 0ns) difference = -difference;
+        if (difference > tolerance) break;
+        if (difference > drift) drift = difference;
+    }
+
+    double virtual_s = std::chrono::duration<double>(sim.now()).count();
+    printf("Възпроизвеждане: %zu събития (%llu фронта, %llu промени на връзката), %.0f s виртуално за %.3f s (x%.0f)\n",
+           events.size(), (unsigned long long)edges, (unsigned long long)links, virtual_s, wall_s,
+           wall_s > 0 ? virtual_s / wall_s : 0.0);
+    printf("Фази: %zu от %zu съвпадат (възпроизведени %zu), най-голямо отклонение %.3f ms\n", matched,
+           recorded.size(), produced.size(), drift.count() / 1e6);
+    if (matched != recorded.size() || produced.size() < recorded.size()) {
+        if (matched < recorded.size()) {
+            printf("Първа разлика при %.3f s: записано 0x%llx\n", recorded[matched].at.count() / 1e9,
+                   (unsigned long long)recorded[matched].value);
+        }
+        return 1;
+    }
+    return 0;
 }
 
-int main() {
-    signal(SIGINT, handle_exit);
+// Median of eleven batches, each of `iterations` calls doubled until it
+// takes at least 50 ms, with the spread between the quartiles and the bus
+// and GPIO work the batches did per call.
+template <class Op>
+BenchResult benchOp(SimHal& sim, const char* name, int iterations, Op op) {
+    auto batchNs = [&op](int calls) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < calls; ++i) op(i);
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    };
+    int batch_calls = iterations;
+    while (batchNs(batch_calls) < 50e6) batch_calls *= 2;
 
-    if (wiringPiSetupGpio() == -1) {
-        printf("Грешка при инициализация на WiringPi\n");
+    TransportStats before = i2c->statistics();
+    uint64_t writes = sim.writes;
+    double per_op[11];
+    for (double& ns : per_op) ns = batchNs(batch_calls) / batch_calls;
+    std::sort(per_op, per_op + 11);
+    const TransportStats& after = i2c->statistics();
+    double calls = 11.0 * batch_calls;
+    BenchResult result;
+    result.name = name;
+    result.ns_per_op = per_op[5];
+    result.ns_spread = per_op[8] - per_op[2];
+    result.i2c_syscalls = (after.syscalls - before.syscalls) / calls;
+    result.i2c_messages = (after.messages - before.messages) / calls;
+    result.i2c_bytes = (after.bytes - before.bytes) / calls;
+    result.gpio_writes = (sim.writes - writes) / calls;
+    return result;
+}
+
+// Times the display, GPIO and sequencing paths on the simulator and writes
+// them as JSON to `path`. With a baseline, fails when anything per operation
+// got worse by more than `threshold` percent.
+int benchmark(const char* path, const char* baseline_path, double threshold) {
+    SimHal sim;
+    hal = &sim;
+    verbose = false;
+    sim.setup();
+    HalTiming<SimHal> timing(sim);
+    HalGpio<SimHal> gpio(sim);
+    AppDisplay display;
+    Controller<SimHal> controller(timing, gpio, display);
+    controller.service_mode = SERVICE_FIXED;
+    controller.setup();
+    setupButton();
+    setupDisplay();
+    controller.startup();
+
+    std::vector<BenchResult> results;
+    results.push_back(benchOp(sim, "initDisplay", 20000, [](int) { initDisplay(); }));
+    results.push_back(benchOp(sim, "clearDisplay", 5000, [](int) {
+        framebuffer.invalidate();
+        clearDisplay();
+    }));
+    results.push_back(benchOp(sim, "countdownFrame", 50000, [](int i) {
+        renderDisplay(DisplaySnapshot{3, int8_t(i % 21), true});
+    }));
+    results.push_back(benchOp(sim, "countdown20", 2000, [](int) {
+        for (int seconds = 20; seconds >= 0; --seconds) renderDisplay(DisplaySnapshot{3, int8_t(seconds), true});
+        renderDisplay(DisplaySnapshot{-1, -1, true});
+    }));
+    results.push_back(benchOp(sim, "pedestrianSequence", 2000, [&controller](int) {
+        controller.pedestrianSequence();
+    }));
+
+    if (!writeBenchJson(results, path)) {
+        printf("Файлът %s не може да бъде записан\n", path);
         return 1;
     }
-    printf("Програмата е стартирана. Чака се за получаване на заявка от пешеходец...\n");
+    if (baseline_path == nullptr) return 0;
 
-    pinMode(CAR_GREEN, OUTPUT);
-    pinMode(CAR_YELLOW, OUTPUT);
-    pinMode(CAR_RED, OUTPUT);
-    pinMode(PED_RED, OUTPUT);
-    pinMode(PED_GREEN, OUTPUT);
-    pinMode(BUTTON_PIN, INPUT);
-    pullUpDnControl(BUTTON_PIN,PUD_UP);
-    pinMode(BUZZER_PIN, OUTPUT);
-
-    digitalWrite(CAR_GREEN, HIGH);
-    digitalWrite(CAR_YELLOW, LOW);
-    digitalWrite(CAR_RED, LOW);
-    digitalWrite(PED_RED, HIGH);
-    digitalWrite(PED_GREEN, LOW);    
-    digitalWrite(BUZZER_PIN, LOW);
-
-    fd = wiringPiI2CSetup(SH1106_I2C_ADDR);
-    if (fd == -1) {
-        printf("Грешка при инициализация на дисплея\n");
+    std::vector<BenchResult> baseline;
+    if (!readBenchJson(baseline_path, baseline)) {
+        printf("Базовият файл %s не може да бъде прочетен\n", baseline_path);
         return 1;
     }
+    printf("Сравнение с %s (праг %.0f%%):\n", baseline_path, threshold);
+    return compareBench(results, baseline, threshold) ? 0 : 1;
+}
 
-    initDisplay();
-    clearDisplay();
+std::vector<std::string> splitList(const char* list) {
+    std::vector<std::string> items;
+    std::string item;
+    for (const char* c = list; ; ++c) {
+        if (*c == ',' || *c == '\0') {
+            if (!item.empty()) items.push_back(item);
+            item.clear();
+            if (*c == '\0') break;
+        } else {
+            item += *c;
+        }
+    }
+    return items;
+}
 
-    if (wiringPiISR(BUTTON_PIN, INT_EDGE_FALLING, &buttonISR) < 0) {
-        printf("Грешка при настройка на ISR\n");
+int usage(const char* program) {
+    printf("Употреба: %s [опция стойност]...\n"
+           "  --simulate N  --trace FILE  --replay FILE  --run N  --tolerance MS\n"
+           "  --bench FILE  --compare BASELINE  --threshold PERCENT\n"
+           "  --service fixed|demand  --log FILE  --links IF[,IF]\n"
+           "  --metrics-file PATH  --metrics-socket PATH\n"
+           "  --control-socket PATH  --control-udp PORT  --control-bind ADDR\n"
+           "  --wave-lead PORT  --wave-follow HOST:PORT  --wave-cycle S  --wave-offset S  --wave-skew MS\n"
+           "  --stats FILE  --stats-budget MB  --plans FILE\n"
+           "  --realtime PRIO[,ISR_PRIO]  --rt-cpu N\n",
+           program);
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    boot_start = EventLoop::now();
+    std::vector<std::string> links = {"eth0"};
+    bool export_metrics = false;
+    const char* bench_path = nullptr;
+    const char* baseline_path = nullptr;
+    double threshold = 15;
+    RealtimeOptions realtime_options;
+    realtime_options.cpu = Realtime::defaultCpu();
+    int simulate_cycles = 0;
+    const char* replay_path = nullptr;
+    int replay_run = 0;
+    double tolerance_ms = 50;
+    int wave_port = -1;
+    std::string wave_leader;
+    double wave_cycle = 90;
+    double wave_offset = 0;
+    const char* stats_path = nullptr;
+    double stats_budget_mb = 8;
+    const char* plans_path = nullptr;
+    const char* control_udp = nullptr;
+    const char* control_bind = "127.0.0.1";
+    for (int i = 1; i < argc; i += 2) {
+        if (std::strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        }
+        if (i + 1 == argc) {
+            printf("Опцията %s няма стойност\n", argv[i]);
+            return usage(argv[0]);
+        }
+        if (std::strcmp(argv[i], "--simulate") == 0) {
+            simulate_cycles = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--trace") == 0) {
+            if (!trace.open(argv[i + 1])) {
+                printf("Файлът за трасе %s не може да бъде отворен\n", argv[i + 1]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--replay") == 0) {
+            replay_path = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--run") == 0) {
+            replay_run = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--tolerance") == 0) {
+            tolerance_ms = std::atof(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--bench") == 0) {
+            bench_path = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--compare") == 0) {
+            baseline_path = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--threshold") == 0) {
+            threshold = std::atof(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--service") == 0) {
+            service_mode = std::strcmp(argv[i + 1], "fixed") == 0 ? SERVICE_FIXED : SERVICE_DEMAND;
+        } else if (std::strcmp(argv[i], "--metrics-file") == 0) {
+            metrics_exporter.writeFile(argv[i + 1]);
+            export_metrics = true;
+        } else if (std::strcmp(argv[i], "--metrics-socket") == 0) {
+            if (!metrics_exporter.listen(argv[i + 1])) {
+                printf("Сокетът за метрики %s не може да бъде отворен\n", argv[i + 1]);
+                return 1;
+            }
+            export_metrics = true;
+        } else if (std::strcmp(argv[i], "--control-socket") == 0) {
+            if (!control_server.listenUnix(argv[i + 1])) {
+                printf("Контролният сокет %s не може да бъде отворен\n", argv[i + 1]);
+                return 1;
+            }
+            control_enabled = true;
+        } else if (std::strcmp(argv[i], "--control-udp") == 0) {
+            control_udp = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--control-bind") == 0) {
+            control_bind = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--wave-lead") == 0) {
+            wave_port = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--wave-follow") == 0) {
+            std::string target = argv[i + 1];
+            size_t colon = target.rfind(':');
+            wave_leader = target.substr(0, colon);
+            wave_port = colon == std::string::npos ? 0 : std::atoi(target.c_str() + colon + 1);
+        } else if (std::strcmp(argv[i], "--wave-cycle") == 0) {
+            wave_cycle = std::atof(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--wave-offset") == 0) {
+            wave_offset = std::atof(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--wave-skew") == 0) {
+            green_wave.skew = std::chrono::nanoseconds(int64_t(std::atof(argv[i + 1]) * 1e6));
+        } else if (std::strcmp(argv[i], "--stats") == 0) {
+            stats_path = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--stats-budget") == 0) {
+            stats_budget_mb = std::atof(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--plans") == 0) {
+            plans_path = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--realtime") == 0) {
+            std::vector<std::string> priorities = splitList(argv[i + 1]);
+            realtime_options.enabled = true;
+            if (priorities.size() > 0) realtime_options.controller_priority = std::atoi(priorities[0].c_str());
+            realtime_options.isr_priority =
+                priorities.size() > 1 ? std::atoi(priorities[1].c_str()) : realtime_options.controller_priority + 5;
+        } else if (std::strcmp(argv[i], "--rt-cpu") == 0) {
+            realtime_options.cpu = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--links") == 0) {
+            links = splitList(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--log") == 0) {
+            if (!logger.openFile(argv[i + 1])) {
+                printf("Файлът за журнал %s не може да бъде отворен\n", argv[i + 1]);
+                return 1;
+            }
+        } else {
+            printf("Непозната опция %s\n", argv[i]);
+            return usage(argv[0]);
+        }
+    }
+    if (control_udp != nullptr) {
+        if (!control_server.listenUdp(uint16_t(std::atoi(control_udp)), control_bind)) {
+            printf("UDP портът за управление %s:%s не може да бъде отворен\n", control_bind, control_udp);
+            return 1;
+        }
+        control_enabled = true;
+    }
+    if (stats_path != nullptr && replay_path == nullptr && bench_path == nullptr &&
+        !demand_store.open(stats_path, size_t(stats_budget_mb * (1 << 20)))) {
+        printf("Файлът за статистика %s не може да бъде отворен\n", stats_path);
         return 1;
     }
+    if (plans_path != nullptr) {
+        if (!plan_watcher.load(plans_path)) return 1;
+        plans_enabled = true;
+    }
+    if (simulate_cycles > 0) return simulate(simulate_cycles);
+    if (replay_path != nullptr) {
+        // --run N: the trace of N runs back, which TraceRecorder moved aside.
+        std::string path = replay_run > 0 ? std::string(replay_path) + "." + std::to_string(replay_run) : replay_path;
+        return replay(path.c_str(), std::chrono::nanoseconds(int64_t(tolerance_ms * 1e6)));
+    }
+    if (bench_path != nullptr) return benchmark(bench_path, baseline_path, threshold);
+    if (wave_port >= 0) {
+        auto cycle = std::chrono::nanoseconds(int64_t(wave_cycle * 1e9));
+        auto offset = std::chrono::nanoseconds(int64_t(wave_offset * 1e9));
+        bool opened = wave_leader.empty() ? green_wave.lead(uint16_t(wave_port), cycle, offset)
+                                          : green_wave.follow(wave_leader.c_str(), uint16_t(wave_port), offset);
+        if (!opened) {
+            printf("Координацията не може да започне на порт %d\n", wave_port);
+            return 1;
+        }
+        wave_enabled = true;
+    }
 
-    std::thread trafficThread(trafficLightController);
-    std::thread ethernetThread(monitorEthernet);
+    // Outputs first: after a crash or a watchdog restart the pins still show
+    // whatever the last process left, possibly a pedestrian green.
+    HalTiming<PiHal> timing(pi_hal);
+    HalGpio<PiHal> gpio(pi_hal);
+    AppDisplay display;
+    Controller<PiHal> controller(timing, gpio, display);
+    controller.service_mode = service_mode;
+    if (plans_enabled) controller.setPlans(&timing_plans);
+    pi_controller = &controller;
+
+    if (!hal->setup()) {
+        printf("Грешка при инициализация на WiringPi\n");
+        return 1;
+    }
+    trace.record(TRACE_MODE, timing.now(), service_mode);
+    controller.setup();
+    auto safe = EventLoop::now() - boot_start;
+    startup_safe_state.record(safe);
+
+    realtime.configure(realtime_options);
+    realtime.leaveRealtimeCpu();
+    realtime.lockMemory();
+    PiHal::edge_thread_setup = [] { realtime.enterIsr(); };
+
+    display_running = true;
+    std::thread displayThread(displayRenderer);
+
+    signal(SIGINT, handle_exit);
+    link_monitor.reset(new LinkMonitor(links));
+    logger.start();
+    printf("Безопасно състояние след %.2f ms\n", safe.count() / 1e6);
+    printf("Програмата е стартирана. Чака се за получаване на заявка от пешеходец...\n");
+
+    setupButton();
+    if (!hal->attachButton(BUTTON_PIN, &piButtonEdge)) {
+        printf("Грешка при настройка на ISR\n");
+        controller.stop();
+    }
+
+    std::thread trafficThread([&controller] {
+        logger.attachThread();
+        realtime.enterController();
+        controller.run();
+        logger.detachThread();
+    });
+    std::thread ethernetThread([] {
+        logger.attachThread();
+        monitorEthernet();
+        logger.detachThread();
+    });
+    std::thread metricsThread;
+    if (METRICS_ENABLED && export_metrics) metricsThread = std::thread([] { metrics_exporter.run(); });
+    std::thread controlThread;
+    if (control_enabled) controlThread = std::thread([] { control_server.run(); });
+    std::thread waveThread;
+    if (wave_enabled) waveThread = std::thread([] { green_wave.run(); });
+    std::thread planThread;
+    if (plans_enabled && plan_watcher.watch()) {
+        planThread = std::thread([] { plan_watcher.run(); });
+    } else if (plans_enabled) {
+        printf("%s не може да бъде наблюдаван, плановете няма да се презареждат\n", plans_path);
+    }
+    stats_running = demand_store.active();
+    std::thread statsThread;
+    if (stats_running) statsThread = std::thread(collectDemand);
 
     trafficThread.join();
+    link_monitor->stop();
     ethernetThread.join();
+    metrics_exporter.stop();
+    if (metricsThread.joinable()) metricsThread.join();
+    control_server.stop();
+    if (controlThread.joinable()) controlThread.join();
+    green_wave.stop();
+    if (waveThread.joinable()) waveThread.join();
+    plan_watcher.stop();
+    if (planThread.joinable()) planThread.join();
+    stats_running = false;
+    stats_loop.wake();
+    if (statsThread.joinable()) statsThread.join();
+    display_running = false;
+    display_loop.wake();
+    displayThread.join();
+    logger.stop();
 
-    digitalWrite(CAR_GREEN, LOW);
-    digitalWrite(CAR_YELLOW, LOW);
-    digitalWrite(CAR_RED, LOW);
-    digitalWrite(PED_RED, LOW);
-    digitalWrite(PED_GREEN, LOW);
-    digitalWrite(BUZZER_PIN, LOW);
+    if (interrupted) {
+        printf("\nСигналът е получен, програмата спира...\n");
+    }
 
-    clearDisplay();
-    turnOffDisplay();
+    hal->writePins(0, OUTPUT_PINS);
+
+    if (i2c) {
+        clearDisplay();
+        turnOffDisplay();
 
+        const TransportStats& stats = i2c->statistics();
+        printf("I2C: %llu системни извиквания, %llu съобщения, %llu байта, %llu грешки\n",
+               (unsigned long long)stats.syscalls, (unsigned long long)stats.messages,
+               (unsigned long long)stats.bytes, (unsigned long long)stats.errors);
+        if (stats.errors == 0) {
+            FILE* marker = fopen(DISPLAY_BLANK_MARKER, "w");
+            if (marker != nullptr) fclose(marker);
+        }
+    }
+    printf("Промени във връзката: %llu, последно засичане %lld us, най-бавно %lld us\n",
+           (unsigned long long)link_monitor->detections,
+           (long long)std::chrono::duration_cast<std::chrono::microseconds>(link_monitor->last_latency).count(),
+           (long long)std::chrono::duration_cast<std::chrono::microseconds>(link_monitor->max_latency).count());
+    printf("Бутон: %llu натискания, %llu отскока, %llu изгубени фронта, реакция p50 %.1f us, p99 %.1f us\n",
+           (unsigned long long)controller.debouncer.accepted,
+           (unsigned long long)controller.debouncer.rejected,
+           (unsigned long long)controller.droppedEdges(),
+           controller.events.press_latency.percentile(50) / 1000.0,
+           controller.events.press_latency.percentile(99) / 1000.0);
+    printf("До зелено за пешеходци: средно %.1f s, p99 %.1f s, необслужени %llu\n",
+           controller.events.walk_latency.mean() / 1e9, controller.events.walk_latency.percentile(99) / 1e9,
+           (unsigned long long)controller.waiting_presses.size());
+    Histogram overshoot;
+    sleep_overshoot.snapshot(overshoot);
+    printf("Закъснение при събуждане: %llu, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+           (unsigned long long)overshoot.count(), overshoot.percentile(50) / 1000.0,
+           overshoot.percentile(99) / 1000.0, overshoot.percentile(99.9) / 1000.0, overshoot.maximum() / 1000.0);
+    realtime.report(stdout);
+    Histogram publish;
+    publish_cost.snapshot(publish);
+    printf("Дисплей: %llu снимки, %llu изчертани, %llu слети, публикуване p50 %llu ns, p99 %llu ns\n",
+           (unsigned long long)display_state.publishedCount(), (unsigned long long)display_state.takenCount(),
+           (unsigned long long)(display_state.publishedCount() - display_state.takenCount()),
+           (unsigned long long)publish.percentile(50), (unsigned long long)publish.percentile(99));
+    printf("Журнал: %llu записа, %llu изгубени\n",
+           (unsigned long long)logger.written(), (unsigned long long)logger.dropped());
+    if (control_enabled) {
+        printf("Управление: %llu заявки в %llu пакета, %llu известия\n",
+               (unsigned long long)control_server.requests, (unsigned long long)control_server.batches,
+               (unsigned long long)control_server.pushed);
+    }
+    if (wave_enabled) {
+        ClockSample best = green_wave.filter.best();
+        printf("Координация: цикъл %.1f s, отместване към водещия %.3f ms (закъснение %.3f ms), %llu обмена, "
+               "%llu отговора\n",
+               green_wave.cycle.count() / 1e9, green_wave.offsetToLeader().count() / 1e6,
+               green_wave.filter.count() > 0 ? best.delay.count() / 1e6 : 0.0,
+               (unsigned long long)green_wave.exchanges, (unsigned long long)green_wave.answered);
+    }
+    if (plans_enabled) {
+        printf("Планове: %llu зареждания, %llu отхвърлени, %llu смени по разписание\n",
+               (unsigned long long)plan_watcher.loads, (unsigned long long)plan_watcher.rejected,
+               (unsigned long long)plan_watcher.switches);
+    }
     printf("Програмата приключи успешно.\n");
+    pi_controller = nullptr;
 
     return 0;
 }
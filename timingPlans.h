@@ -0,0 +1,507 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include "phaseEngine.h"
+#include "trafficPlan.h"
+
+// Pedestrian plans read from a file instead of compiled in:
+//
+//   # seconds per phase; peds_go is the countdown
+//   plan day
+//       cars_go 5
+//       cars_stop 2
+//       all_red 2
+//       peds_go 20
+//       all_red 5
+//       cars_stop 2
+//   plan night
+//       ...
+//   at mon-fri 07:00 day
+//   at * 22:00 night
+//
+// Phases are named after TrafficPlan's output states, so a file can change
+// timings and order but never invent an output combination. `at` lines pick
+// the plan in force by local time of day and weekday (sun..sat, ranges and
+// lists, * for every day); without any the first plan is always in force.
+
+constexpr size_t MAX_PLAN_PHASES = 12;
+constexpr size_t MAX_PLANS = 8;
+constexpr size_t PLAN_NAME_SIZE = 16;
+
+// Bounds on top of validPlan(): a yellow long enough to stop for, a walk
+// that fits the two-digit countdown and an all-red clearance after it.
+constexpr uint16_t MAX_PHASE_SECONDS = 600;
+constexpr uint16_t MIN_YELLOW_SECONDS = 2;
+constexpr uint16_t MIN_WALK_SECONDS = 5;
+constexpr uint16_t MAX_WALK_SECONDS = 99;
+constexpr uint16_t MIN_CLEARANCE_SECONDS = 2;
+
+enum PlanPhaseKind : uint8_t { PLAN_CARS_GO, PLAN_CARS_STOP, PLAN_ALL_RED, PLAN_PEDS_GO };
+
+const char* const PLAN_PHASE_NAMES[] = {"cars_go", "cars_stop", "all_red", "peds_go"};
+const char* const PLAN_DAY_NAMES[] = {"sun", "mon", "tue", "wed", "thu", "fri", "sat"};
+
+struct PlanPhaseDef {
+    PlanPhaseKind kind;
+    uint16_t seconds;
+};
+
+struct PlanDef {
+    char name[PLAN_NAME_SIZE];
+    PlanPhaseDef phases[MAX_PLAN_PHASES];
+    size_t count;
+};
+
+// From `minute` of the day on the days in `days` (bit 0 is Sunday, as
+// tm_wday counts) the plan at index `plan` is in force.
+struct PlanScheduleEntry {
+    uint8_t days;
+    uint16_t minute;
+    uint8_t plan;
+};
+
+struct PlanConfig {
+    PlanDef plans[MAX_PLANS];
+    size_t count = 0;
+    std::vector<PlanScheduleEntry> schedule;
+
+    int find(const char* name) const {
+        for (size_t i = 0; i < count; ++i) {
+            if (std::strcmp(plans[i].name, name) == 0) return int(i);
+        }
+        return -1;
+    }
+
+    // The entry that started most recently, looking back up to a week.
+    int activeAt(const struct tm& local) const {
+        int now = local.tm_hour * 60 + local.tm_min;
+        for (int back = 0; back <= 7; ++back) {
+            int day = (local.tm_wday - back % 7 + 7) % 7;
+            const PlanScheduleEntry* best = nullptr;
+            for (const PlanScheduleEntry& entry : schedule) {
+                if (!(entry.days & (1 << day)) || (back == 0 && entry.minute > now)) continue;
+                if (best == nullptr || entry.minute >= best->minute) best = &entry;
+            }
+            if (best != nullptr) return best->plan;
+        }
+        return 0;
+    }
+};
+
+// What the controller runs: one plan with its outputs resolved, immutable
+// once published. `plan` points into `phases`, so snapshots are never
+// copied, only handed around by pointer.
+struct PlanSnapshot {
+    uint64_t generation = 0;
+    char name[PLAN_NAME_SIZE] = {};
+    Phase phases[MAX_PLAN_PHASES] = {};
+    PhasePlan plan = {phases, 0, 0};
+
+    PlanSnapshot() = default;
+    PlanSnapshot(const PlanSnapshot&) = delete;
+    PlanSnapshot& operator=(const PlanSnapshot&) = delete;
+};
+
+// Same phases with the same outputs in the same order: only durations
+// differ, so a running sequence can switch over at a phase boundary.
+inline bool samePhases(const PhasePlan& a, const PhasePlan& b) {
+    if (a.count != b.count || a.rest != b.rest) return false;
+    for (size_t i = 0; i < a.count; ++i) {
+        if (a.phases[i].outputs != b.phases[i].outputs || a.phases[i].countdown != b.phases[i].countdown) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Resolves a plan against the pin assignment and checks it as TrafficPlan
+// checks the compiled-in one at compile time. Null with `error` set if the
+// plan is not safe to run.
+template <class Pins>
+std::unique_ptr<PlanSnapshot> resolvePlan(const PlanDef& def, const char*& error) {
+    using Plan = TrafficPlan<Pins>;
+    const uint32_t outputs[] = {Plan::CARS_GO, Plan::CARS_STOP, Plan::ALL_RED, Plan::PEDS_GO};
+
+    std::unique_ptr<PlanSnapshot> snapshot(new PlanSnapshot());
+    std::memcpy(snapshot->name, def.name, PLAN_NAME_SIZE);
+    int walks = 0;
+    for (size_t i = 0; i < def.count; ++i) {
+        const PlanPhaseDef& phase = def.phases[i];
+        bool walk = phase.kind == PLAN_PEDS_GO;
+        snapshot->phases[i] = Phase{outputs[phase.kind], phase.seconds, walk};
+        if (phase.seconds == 0 || phase.seconds > MAX_PHASE_SECONDS) {
+            error = "продължителност извън 1..600 s";
+            return nullptr;
+        }
+        if (phase.kind == PLAN_CARS_STOP && phase.seconds < MIN_YELLOW_SECONDS) {
+            error = "жълто под 2 s";
+            return nullptr;
+        }
+        if (walk) {
+            walks += 1;
+            if (phase.seconds < MIN_WALK_SECONDS || phase.seconds > MAX_WALK_SECONDS) {
+                error = "пешеходно зелено извън 5..99 s";
+                return nullptr;
+            }
+            if (i + 1 == def.count || def.phases[i + 1].kind != PLAN_ALL_RED ||
+                def.phases[i + 1].seconds < MIN_CLEARANCE_SECONDS) {
+                error = "след пешеходно зелено трябва all_red поне 2 s";
+                return nullptr;
+            }
+        }
+    }
+    if (walks != 1) {
+        error = "планът трябва да има точно една фаза peds_go";
+        return nullptr;
+    }
+    snapshot->plan = PhasePlan{snapshot->phases, def.count, Plan::CARS_GO};
+    if (!validPlan(snapshot->plan, Plan::SIGNALS)) {
+        error = "зелено без жълто преди червено или зелени едновременно";
+        return nullptr;
+    }
+    return snapshot;
+}
+
+inline bool parseDays(const char* text, uint8_t& days) {
+    days = 0;
+    if (std::strcmp(text, "*") == 0) {
+        days = 0x7F;
+        return true;
+    }
+    std::string list(text);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        std::string item = list.substr(start, end - start);
+        size_t dash = item.find('-');
+        int first = -1, last = -1;
+        for (int day = 0; day < 7; ++day) {
+            if (item.compare(0, dash, PLAN_DAY_NAMES[day]) == 0) first = day;
+            if (dash != std::string::npos && item.compare(dash + 1, std::string::npos, PLAN_DAY_NAMES[day]) == 0) {
+                last = day;
+            }
+        }
+        if (dash == std::string::npos) last = first;
+        if (first < 0 || last < 0) return false;
+        for (int day = first;; day = (day + 1) % 7) {
+            days |= uint8_t(1 << day);
+            if (day == last) break;
+        }
+        start = end + 1;
+    }
+    return days != 0;
+}
+
+// Parses the whole file; on failure `line` and `error` say where and why.
+inline bool parsePlanConfig(const char* text, PlanConfig& config, int& line, const char*& error) {
+    config = PlanConfig();
+    PlanDef* current = nullptr;
+    line = 0;
+    const char* cursor = text;
+    while (*cursor) {
+        const char* end = std::strchr(cursor, '\n');
+        if (end == nullptr) end = cursor + std::strlen(cursor);
+        std::string row(cursor, end);
+        cursor = *end ? end + 1 : end;
+        line += 1;
+        size_t hash = row.find('#');
+        if (hash != std::string::npos) row.resize(hash);
+
+        char word[32], arg1[32], arg2[32], arg3[32];
+        int fields = sscanf(row.c_str(), "%31s %31s %31s %31s", word, arg1, arg2, arg3);
+        if (fields <= 0) continue;
+
+        if (std::strcmp(word, "plan") == 0) {
+            if (fields != 2 || std::strlen(arg1) >= PLAN_NAME_SIZE) {
+                error = "очаква се plan ИМЕ (до 15 знака)";
+                return false;
+            }
+            if (config.count == MAX_PLANS || config.find(arg1) >= 0) {
+                error = config.count == MAX_PLANS ? "повече от 8 плана" : "планът вече е описан";
+                return false;
+            }
+            current = &config.plans[config.count++];
+            *current = PlanDef{};
+            std::strcpy(current->name, arg1);
+        } else if (std::strcmp(word, "at") == 0) {
+            uint8_t days;
+            int hours, minutes, plan = -1;
+            char tail;
+            if (fields != 4 || !parseDays(arg1, days) || sscanf(arg2, "%d:%d%c", &hours, &minutes, &tail) != 2 ||
+                hours < 0 || hours > 23 || minutes < 0 || minutes > 59 || (plan = config.find(arg3)) < 0) {
+                error = plan < 0 && fields == 4 ? "неизвестен план или ден" : "очаква се at ДНИ ЧЧ:ММ ПЛАН";
+                return false;
+            }
+            config.schedule.push_back(PlanScheduleEntry{days, uint16_t(hours * 60 + minutes), uint8_t(plan)});
+        } else {
+            int kind = -1;
+            for (int k = PLAN_CARS_GO; k <= PLAN_PEDS_GO; ++k) {
+                if (std::strcmp(word, PLAN_PHASE_NAMES[k]) == 0) kind = k;
+            }
+            unsigned seconds;
+            char tail;
+            if (kind < 0 || fields != 2 || sscanf(arg1, "%u%c", &seconds, &tail) != 1) {
+                error = "очаква се plan, at или ФАЗА СЕКУНДИ";
+                return false;
+            }
+            if (current == nullptr || current->count == MAX_PLAN_PHASES) {
+                error = current == nullptr ? "фаза извън план" : "повече от 12 фази";
+                return false;
+            }
+            current->phases[current->count++] =
+                PlanPhaseDef{PlanPhaseKind(kind), uint16_t(seconds > 0xFFFF ? 0xFFFF : seconds)};
+        }
+    }
+    if (config.count == 0) {
+        error = "няма нито един план";
+        return false;
+    }
+    return true;
+}
+
+// Read-copy-update for one reader thread (the controller) and one writer
+// thread (the watcher). The reader loads `current()` with no lock, no
+// allocation and no reference count, and says which snapshot it is using
+// with hold(). Generations only grow, so everything retired older than the
+// held one can no longer be reached and is freed on the next publish.
+class PlanCell {
+public:
+    ~PlanCell() {
+        delete latest.load();
+    }
+
+    const PlanSnapshot* current() const {
+        return latest.load(std::memory_order_acquire);
+    }
+
+    void hold(const PlanSnapshot* snapshot) {
+        held.store(snapshot->generation, std::memory_order_seq_cst);
+    }
+
+    void publish(std::unique_ptr<PlanSnapshot> next) {
+        next->generation = ++generations;
+        PlanSnapshot* previous = latest.exchange(next.release(), std::memory_order_seq_cst);
+        if (previous != nullptr) retired.emplace_back(previous);
+        uint64_t in_use = held.load(std::memory_order_seq_cst);
+        for (size_t i = 0; i < retired.size();) {
+            if (retired[i]->generation < in_use) {
+                retired[i] = std::move(retired.back());
+                retired.pop_back();
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    size_t retiredCount() const {
+        return retired.size();
+    }
+
+private:
+    std::atomic<PlanSnapshot*> latest{nullptr};
+    std::atomic<uint64_t> held{0};
+    uint64_t generations = 0;
+    std::vector<std::unique_ptr<PlanSnapshot>> retired;
+};
+
+// Loads the plan file into a PlanCell and keeps it current on its own
+// thread: inotify on the directory (editors replace files by rename), and a
+// wake-up every wall-clock minute for the schedule. A file that does not
+// parse or validate is reported and the plan in force stays. `report` gets
+// one line of text per load, rejection or switch.
+template <class Pins>
+class PlanWatcher {
+public:
+    PlanWatcher(PlanCell& cell, void (*report)(const char* message)) : cell(cell), report(report) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        add(wake_fd);
+    }
+
+    ~PlanWatcher() {
+        if (inotify_fd >= 0) close(inotify_fd);
+        close(wake_fd);
+        close(epoll_fd);
+    }
+
+    PlanWatcher(const PlanWatcher&) = delete;
+    PlanWatcher& operator=(const PlanWatcher&) = delete;
+
+    // Loads `file` once; false if it cannot be read or is rejected.
+    bool load(const char* file) {
+        path = file;
+        size_t slash = path.rfind('/');
+        directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        name = slash == std::string::npos ? path : path.substr(slash + 1);
+        return reload();
+    }
+
+    // Watching starts here rather than in run(), so nothing written after
+    // watch() returns is missed.
+    bool watch() {
+        inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        if (inotify_fd < 0 ||
+            inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            return false;
+        }
+        add(inotify_fd);
+        return true;
+    }
+
+    // Blocks until stop(). Safe to call stop() from a signal handler.
+    void run() {
+        while (!stopping) {
+            auto wall = std::chrono::system_clock::now().time_since_epoch();
+            auto next = std::chrono::duration_cast<std::chrono::minutes>(wall) + std::chrono::minutes(1);
+            int timeout = int(std::chrono::duration_cast<std::chrono::milliseconds>(next - wall).count()) + 1;
+            epoll_event events[2];
+            int count = epoll_wait(epoll_fd, events, 2, timeout);
+            if (count < 0 && errno != EINTR) return;
+            bool changed = false;
+            for (int i = 0; i < count; ++i) {
+                if (events[i].data.fd == wake_fd) {
+                    uint64_t value;
+                    ssize_t n = read(wake_fd, &value, sizeof(value));
+                    (void)n;
+                } else {
+                    changed |= fileChanged();
+                }
+            }
+            if (changed) {
+                reload();
+            } else {
+                schedule(false);
+            }
+        }
+    }
+
+    void stop() {
+        stopping = true;
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    uint64_t loads = 0;
+    uint64_t rejected = 0;
+    uint64_t switches = 0;
+
+private:
+    void add(int descriptor) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = descriptor;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, descriptor, &event);
+    }
+
+    bool fileChanged() {
+        alignas(inotify_event) char buffer[4096];
+        bool ours = false;
+        ssize_t length;
+        while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+            for (char* at = buffer; at < buffer + length;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(at);
+                if (event->len > 0 && name == event->name) ours = true;
+                at += sizeof(inotify_event) + event->len;
+            }
+        }
+        return ours;
+    }
+
+    bool reload() {
+        char message[192];
+        std::string text;
+        if (!readFile(text)) {
+            rejected += 1;
+            snprintf(message, sizeof(message), "Плановете в %s не могат да бъдат прочетени", path.c_str());
+            report(message);
+            return false;
+        }
+        std::unique_ptr<PlanConfig> parsed(new PlanConfig());
+        int line = 0;
+        const char* error = nullptr;
+        if (!parsePlanConfig(text.c_str(), *parsed, line, error)) {
+            snprintf(message, sizeof(message), "%s, ред %d: %s%s", path.c_str(), line, error, keeping());
+            report(message);
+            rejected += 1;
+            return false;
+        }
+        for (size_t i = 0; i < parsed->count; ++i) {
+            if (!resolvePlan<Pins>(parsed->plans[i], error)) {
+                snprintf(message, sizeof(message), "План %s в %s е отхвърлен: %s%s", parsed->plans[i].name,
+                         path.c_str(), error, keeping());
+                report(message);
+                rejected += 1;
+                return false;
+            }
+        }
+        config = std::move(parsed);
+        loads += 1;
+        snprintf(message, sizeof(message), "Заредени %zu плана от %s", config->count, path.c_str());
+        report(message);
+        schedule(true);
+        return true;
+    }
+
+    const char* keeping() const {
+        return config != nullptr ? "; остава досегашният план" : "";
+    }
+
+    bool readFile(std::string& text) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        char buffer[4096];
+        ssize_t length;
+        while ((length = read(fd, buffer, sizeof(buffer))) > 0 && text.size() < (64 << 10)) {
+            text.append(buffer, size_t(length));
+        }
+        close(fd);
+        return length == 0;
+    }
+
+    // Publishes the plan in force now if it changed, or always after a
+    // reload since its timings may have.
+    void schedule(bool reloaded) {
+        if (config == nullptr) return;
+        time_t now = time(nullptr);
+        struct tm local;
+        localtime_r(&now, &local);
+        int index = config->activeAt(local);
+        if (!reloaded && index == active) return;
+        const char* error = nullptr;
+        std::unique_ptr<PlanSnapshot> snapshot = resolvePlan<Pins>(config->plans[index], error);
+        if (!reloaded) switches += 1;
+        active = index;
+        char message[96];
+        snprintf(message, sizeof(message), "План в сила: %s", snapshot->name);
+        report(message);
+        cell.publish(std::move(snapshot));
+    }
+
+    PlanCell& cell;
+    void (*report)(const char* message);
+    std::string path;
+    std::string directory;
+    std::string name;
+    std::unique_ptr<PlanConfig> config;
+    int active = -1;
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    int inotify_fd = -1;
+    std::atomic<bool> stopping{false};
+};
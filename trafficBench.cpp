@@ -0,0 +1,907 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include "intersectionRuntime.h"
+#include "buttonEdges.h"
+#include "asyncLog.h"
+#include "glyphFont.h"
+#include "i2cTransport.h"
+#include "linkMonitor.h"
+#include "metrics.h"
+#include "trafficController.h"
+#include "displayPolicies.h"
+#include "eventTrace.h"
+#include "controlApi.h"
+#include "greenWave.h"
+#include "demandStats.h"
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#include "coroutineSequencer.h"
+#endif
+
+using namespace std::chrono_literals;
+
+void runtimeScaling(int workers, double hours) {
+    printf("Многокръстовищен runtime: %d работни нишки, %.1f h виртуално време\n", workers, hours);
+    printf("%8s %12s %14s %10s %10s %10s %10s %10s\n",
+           "N", "събития", "събития/s", "p50 us", "p99 us", "p99.9 us", "max us", "кражби");
+
+    for (int count : {10, 100, 1000, 10000}) {
+        std::vector<std::unique_ptr<Intersection>> intersections;
+        IntersectionRuntime runtime(workers, count, 100ms, false);
+        for (int i = 0; i < count; ++i) {
+            intersections.emplace_back(new Intersection(i + 1, 90s));
+            runtime.add(intersections.back().get());
+        }
+
+        auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(hours * 3600));
+        RuntimeReport report = runtime.run(duration);
+        printf("%8d %12llu %14.0f %10.1f %10.1f %10.1f %10.1f %10llu\n",
+               count, (unsigned long long)report.events, report.events / report.wall_seconds,
+               report.latency.percentile(50) / 1000.0, report.latency.percentile(99) / 1000.0,
+               report.latency.percentile(99.9) / 1000.0, report.latency.maximum() / 1000.0,
+               (unsigned long long)report.steals);
+    }
+}
+
+// A worn button on a real interrupt thread: bursts of `bounces` edges
+// `spacing` apart go through the ring to a consumer that sleeps on the event
+// loop, as the controller does. Reports the cost of the producer side and the
+// time from each accepted edge to the consumer acting on it.
+void bounceStorm(int presses, int bounces, std::chrono::nanoseconds spacing) {
+    EdgeRing<256> ring;
+    EventLoop loop;
+    Debouncer debouncer(300ms);
+    Histogram push_cost, handling;
+    std::atomic<bool> done{false};
+
+    std::thread consumer([&] {
+        ButtonEdge edge;
+        while (true) {
+            bool finished = done.load();
+            while (ring.pop(edge)) {
+                if (debouncer.accept(edge)) handling.record((EventLoop::now() - edge.timestamp).count());
+            }
+            if (finished) break;
+            loop.waitUntil(EventLoop::FOREVER);
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    auto at = EventLoop::now();
+    for (int press = 0; press < presses; ++press) {
+        for (int edge = 0; edge <= bounces; ++edge) {
+            at += spacing;
+            while (EventLoop::now() < at) {
+            }
+            auto before = EventLoop::now();
+            ring.push(ButtonEdge{before, false});
+            loop.wake();
+            push_cost.record((EventLoop::now() - before).count());
+        }
+        // Next press after the lockout, so each burst yields one press.
+        at += 310ms;
+    }
+    done = true;
+    loop.wake();
+    consumer.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t edges = uint64_t(presses) * (bounces + 1);
+    printf("Буря от отскоци: %llu фронта за %.2f s (%.0f/s в пакет), %llu натискания, %llu отхвърлени, %llu изгубени\n",
+           (unsigned long long)edges, seconds, 1e9 / double(spacing.count()),
+           (unsigned long long)debouncer.accepted, (unsigned long long)debouncer.rejected,
+           (unsigned long long)ring.droppedCount());
+    printf("  запис в опашката: p50 %.2f us, p99 %.2f us, max %.2f us\n",
+           push_cost.percentile(50) / 1000.0, push_cost.percentile(99) / 1000.0, push_cost.maximum() / 1000.0);
+    printf("  фронт -> обработка: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           handling.percentile(50) / 1000.0, handling.percentile(99) / 1000.0, handling.maximum() / 1000.0);
+}
+
+// Cost of one log call on the calling thread, for the asynchronous logger
+// and for the printf it replaces, both writing to /dev/null. Calls come in
+// blocks of 100 with a pause between them, so the logger keeps up; a final
+// burst with no pauses shows what overload drops.
+void logCallCost(int blocks) {
+    const LogFormat formats[] = {
+        {"Оставащи секунди: %lld\n", false},
+        {"%s свързан!\n", true},
+    };
+    FILE* sink = fopen("/dev/null", "w");
+    AsyncLogger logger(formats, 2, sink);
+    logger.attachThread();
+    logger.start();
+
+    Histogram async_cost, printf_cost;
+    for (int block = 0; block < blocks; ++block) {
+        auto start = EventLoop::now();
+        for (int i = 0; i < 100; ++i) logger.log(i & 1, "eth0", i);
+        async_cost.record((EventLoop::now() - start).count() / 100);
+
+        start = EventLoop::now();
+        for (int i = 0; i < 100; ++i) fprintf(sink, "Оставащи секунди: %d\n", i);
+        printf_cost.record((EventLoop::now() - start).count() / 100);
+
+        auto resume = EventLoop::now() + 1ms;
+        while (EventLoop::now() < resume) {
+        }
+    }
+    uint64_t paced_dropped = logger.dropped();
+
+    auto start = EventLoop::now();
+    const int burst = 1000000;
+    for (int i = 0; i < burst; ++i) logger.log(0, i);
+    double burst_ns = double((EventLoop::now() - start).count()) / burst;
+    logger.stop();
+
+    printf("Журнал: %d блока по 100 извиквания, %llu изгубени\n", blocks, (unsigned long long)paced_dropped);
+    printf("  асинхронен запис: p50 %llu ns, p99 %llu ns, max %llu ns на извикване\n",
+           (unsigned long long)async_cost.percentile(50), (unsigned long long)async_cost.percentile(99),
+           (unsigned long long)async_cost.maximum());
+    printf("  fprintf:          p50 %llu ns, p99 %llu ns, max %llu ns на извикване\n",
+           (unsigned long long)printf_cost.percentile(50), (unsigned long long)printf_cost.percentile(99),
+           (unsigned long long)printf_cost.maximum());
+    printf("  претоварване: %d извиквания по %.1f ns, записани общо %llu, изгубени %llu\n", burst, burst_ns,
+           (unsigned long long)logger.written(), (unsigned long long)(logger.dropped() - paced_dropped));
+    fclose(sink);
+}
+
+// Time to draw one countdown frame and flush it to a counting bus: from the
+// "00".."99" atlas, through the 2x text renderer, and byte by byte with
+// set() as the old digit code did. Frames count 99..0 so every one changes.
+template <class Draw>
+void renderCase(const char* name, int rounds, Draw draw) {
+    SH1106Framebuffer framebuffer;
+    MockBus bus;
+    framebuffer.flush(bus);
+    bus.stats = BusStats();
+
+    auto start = EventLoop::now();
+    for (int round = 0; round < rounds; ++round) {
+        for (int value = 99; value >= 0; --value) {
+            draw(framebuffer, value);
+            framebuffer.flush(bus);
+        }
+    }
+    double frames = 100.0 * rounds;
+    printf("  %8.1f ns/кадър, %6.1f байта/кадър  %s\n",
+           double((EventLoop::now() - start).count()) / frames, double(bus.stats.bytes) / frames, name);
+}
+
+void renderTime(int rounds) {
+    printf("Изчертаване на отброяване (%d кадъра):\n", rounds * 100);
+    renderCase("атлас 2x", rounds, [](SH1106Framebuffer& framebuffer, int value) {
+        drawCountdown<2>(framebuffer, 3, 44, value);
+    });
+    renderCase("текст 2x", rounds, [](SH1106Framebuffer& framebuffer, int value) {
+        char digits[3] = {char('0' + value / 10), char('0' + value % 10), '\0'};
+        drawText<2>(framebuffer, 3, 44, digits);
+    });
+    renderCase("байт по байт", rounds, [](SH1106Framebuffer& framebuffer, int value) {
+        for (int page = 0; page < 2; ++page) {
+            for (int x = 0; x < CountdownAtlas<2>::WIDTH; ++x) {
+                framebuffer.set(3 + page, 44 + x, COUNTDOWN_ATLAS<2>.frames[value][page][x]);
+            }
+        }
+    });
+    renderCase("статус 1x", rounds, [](SH1106Framebuffer& framebuffer, int value) {
+        drawText<1>(framebuffer, 6, 35, value & 1 ? "NO LINK" : "WAIT   ");
+    });
+}
+
+// What the batched transport puts on a recording bus per frame: I2C_RDWR
+// syscalls, messages and bytes for a full redraw, a countdown tick and a
+// status line change, next to the byte-per-transaction MockBus figures above.
+template <class Draw>
+void transportCase(const char* name, int frames, Draw draw) {
+    RecordingI2CBackend backend;
+    I2CTransport i2c(backend, 0x3C);
+    SH1106Framebuffer framebuffer;
+    framebuffer.flush(i2c);
+
+    uint64_t syscalls = 0, messages = 0, bytes = 0;
+    for (int frame = 0; frame < frames; ++frame) {
+        backend.reset();
+        draw(framebuffer, frame);
+        framebuffer.flush(i2c);
+        syscalls += backend.syscalls;
+        messages += backend.messages.size();
+        bytes += backend.bytes;
+    }
+    printf("  %6.2f syscall, %6.2f съобщения, %7.1f байта на кадър  %s\n", double(syscalls) / frames,
+           double(messages) / frames, double(bytes) / frames, name);
+}
+
+void transportFrames(int frames) {
+    printf("I2C_RDWR към записваща шина (%d кадъра):\n", frames);
+    transportCase("цял екран", frames, [](SH1106Framebuffer& framebuffer, int) {
+        framebuffer.invalidate();
+    });
+    transportCase("отброяване", frames, [](SH1106Framebuffer& framebuffer, int frame) {
+        drawCountdown<2>(framebuffer, 3, 44, 99 - frame % 100);
+    });
+    transportCase("статус", frames, [](SH1106Framebuffer& framebuffer, int frame) {
+        drawText<1>(framebuffer, 6, 35, frame & 1 ? "NO LINK" : "WAIT   ");
+    });
+}
+
+LatencyHistogram bench_latency("bench_latency_seconds", "Instrumentation benchmark");
+
+// Cost of one instrumented point (two clock reads and a record), measured
+// around an eventfd wakeup, against the shortest I2C transfer the display
+// path makes: a two-digit countdown frame, ~50 bytes at 400 kHz.
+void metricsOverhead(int iterations) {
+    EventLoop loop;
+    auto start = EventLoop::now();
+    for (int i = 0; i < iterations; ++i) loop.wake();
+    double bare_ns = double((EventLoop::now() - start).count()) / iterations;
+
+    start = EventLoop::now();
+    for (int i = 0; i < iterations; ++i) {
+        auto begin = metricsNow();
+        loop.wake();
+        bench_latency.record(metricsNow() - begin);
+    }
+    double point_ns = double((EventLoop::now() - start).count()) / iterations - bare_ns;
+    const double frame_ns = 50 * 9 / 400e3 * 1e9;
+
+    printf("Метрики (%s): %.1f ns на измерване, %.4f%% от I2C кадър на отброяване\n",
+           METRICS_ENABLED ? "включени" : "изключени", point_ns, 100.0 * point_ns / frame_ns);
+}
+
+// One RTM_NEWLINK as the kernel sends it: interface name and operstate.
+size_t linkMessage(char* buffer, const char* name, bool up) {
+    std::memset(buffer, 0, 256);
+    nlmsghdr* nh = reinterpret_cast<nlmsghdr*>(buffer);
+    nh->nlmsg_type = RTM_NEWLINK;
+    nh->nlmsg_len = NLMSG_LENGTH(sizeof(ifinfomsg));
+    rtattr* attr = reinterpret_cast<rtattr*>(buffer + NLMSG_ALIGN(nh->nlmsg_len));
+    attr->rta_type = IFLA_IFNAME;
+    attr->rta_len = RTA_LENGTH(std::strlen(name) + 1);
+    std::memcpy(RTA_DATA(attr), name, std::strlen(name) + 1);
+    nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_ALIGN(attr->rta_len);
+    attr = reinterpret_cast<rtattr*>(buffer + nh->nlmsg_len);
+    attr->rta_type = IFLA_OPERSTATE;
+    attr->rta_len = RTA_LENGTH(1);
+    *static_cast<uint8_t*>(RTA_DATA(attr)) = up ? 6 : 2;
+    nh->nlmsg_len += RTA_ALIGN(attr->rta_len);
+    return nh->nlmsg_len;
+}
+
+// Link changes injected as RTM_NEWLINK through LinkMonitor::attach() on a
+// socketpair, one at a time: send to callback as seen by the sender, and the
+// latency the monitor itself records.
+void linkDetection(int changes) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        printf("Връзка: socketpair не може да бъде създаден\n");
+        return;
+    }
+    LinkMonitor monitor({"bench0"});
+    monitor.attach(fds[0]);
+    Histogram delivery;
+    std::atomic<std::chrono::nanoseconds::rep> sent_at{0};
+    std::atomic<int> seen{0};
+    std::thread watcher([&] {
+        monitor.run([&](const std::string&, bool) {
+            delivery.record(LinkMonitor::now().count() - sent_at.load());
+            seen.fetch_add(1);
+        });
+    });
+
+    char buffer[256];
+    for (int i = 0; i < changes; ++i) {
+        size_t length = linkMessage(buffer, "bench0", i % 2 == 0);
+        sent_at = LinkMonitor::now().count();
+        if (send(fds[1], buffer, length, 0) != ssize_t(length)) break;
+        while (seen.load() <= i) std::this_thread::yield();
+    }
+    monitor.stop();
+    watcher.join();
+    close(fds[1]);
+
+    printf("Връзка: %llu промени през netlink съобщения, изпращане -> обработка p50 %.1f us, p99 %.1f us; "
+           "засичане последно %.1f us, най-бавно %.1f us\n",
+           (unsigned long long)monitor.detections, delivery.percentile(50) / 1000.0, delivery.percentile(99) / 1000.0,
+           monitor.last_latency.count() / 1000.0, monitor.max_latency.count() / 1000.0);
+}
+
+// Cost of one trace record on the calling thread and its size, for a mix
+// like a real day's: phase changes seconds apart, button bursts with
+// bounces a millisecond apart. Then how fast the file decodes again.
+void traceCost(int records) {
+    const char* path = "/tmp/trafficBench.trace";
+    TraceRecorder recorder;
+    if (!recorder.open(path, 64 << 20)) {
+        printf("Трасе: %s не може да бъде създаден\n", path);
+        return;
+    }
+    auto at = EventLoop::now();
+    auto start = EventLoop::now();
+    for (int i = 0; i < records; ++i) {
+        if (i % 10 < 8) {
+            at += 1ms;
+            recorder.record(TRACE_EDGE, at, 0);
+        } else {
+            at += 5s;
+            recorder.record(TRACE_PHASE, at, 0x2420000);
+        }
+    }
+    double record_ns = double((EventLoop::now() - start).count()) / records;
+    double bytes = double(recorder.bytes) / records;
+    recorder.close();
+
+    std::vector<TraceEvent> events;
+    events.reserve(records);
+    start = EventLoop::now();
+    readTrace(path, events);
+    double decode_ns = double((EventLoop::now() - start).count()) / (events.empty() ? 1 : events.size());
+    unlink(path);
+    printf("Трасе: %.1f ns и %.2f байта на запис, декодиране %.1f ns на запис (%zu записа)\n", record_ns, bytes,
+           decode_ns, events.size());
+}
+
+constexpr int STRATEGY_SPEEDUP = 1000;
+
+struct StrategyEvents : NoEvents {
+    void sequenceStarted(std::chrono::nanoseconds waited) {
+        press_to_sequence.record(waited.count() / STRATEGY_SPEEDUP);
+    }
+
+    void overshoot(std::chrono::nanoseconds lateness) {
+        late.record(lateness.count() / STRATEGY_SPEEDUP);
+    }
+
+    void sequenceFinished(std::chrono::nanoseconds) {
+        cycles.fetch_add(1);
+    }
+
+    Histogram press_to_sequence;
+    Histogram late;
+    std::atomic<uint64_t> cycles{0};
+};
+
+// One old variant's threading strategy on the shared controller, running
+// STRATEGY_SPEEDUP times faster than real time on a counting GPIO and bus:
+// a press, a full pedestrian cycle, the next press. CPU time is the whole
+// process's and lateness and press-to-sequence are in real time.
+template <class Sync, class Timing>
+void strategyCase(const char* name, int cycles) {
+    using Controller = TrafficController<BoardPins, Sync, Timing, CountingGpio, FramebufferDisplay<MockBus>,
+                                         StrategyEvents>;
+    Timing timing;
+    CountingGpio gpio;
+    MockBus bus;
+    FramebufferDisplay<MockBus> display(bus);
+    Controller controller(timing, gpio, display);
+    controller.service_mode = SERVICE_FIXED;
+    controller.setup();
+
+    timespec cpu_start, cpu_end;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+    std::thread runner([&controller] { controller.run(); });
+    for (int cycle = 0; cycle < cycles; ++cycle) {
+        controller.onButtonEdge(ButtonEdge{timing.now(), false});
+        while (controller.events.cycles.load() <= uint64_t(cycle)) std::this_thread::sleep_for(1ms);
+    }
+    controller.stop();
+    runner.join();
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+
+    double cpu_ns = (cpu_end.tv_sec - cpu_start.tv_sec) * 1e9 + (cpu_end.tv_nsec - cpu_start.tv_nsec);
+    const StrategyEvents& events = controller.events;
+    printf("  %6d %12.1f %12.1f %12.1f %12.1f  %s\n", cycles, cpu_ns / cycles / 1000.0,
+           events.late.percentile(99) / 1000.0, events.late.maximum() / 1000.0,
+           events.press_to_sequence.percentile(99) / 1000.0, name);
+}
+
+// The counters from several threads at once, as the button, controller and
+// control threads add them, with the minute thread collecting every 1000th
+// add into a store.
+void demandCost(int adds, int threads) {
+    const char* path = "/tmp/trafficBench.demand";
+    unlink(path);
+    DemandStats stats;
+    DemandStore store;
+    if (!store.open(path)) {
+        printf("Статистика: %s не може да бъде създаден\n", path);
+        return;
+    }
+    std::atomic<bool> running(true);
+    uint64_t collects = 0;
+    std::thread collector([&] {
+        for (uint32_t minute = 0; running.load(std::memory_order_relaxed); ++minute) {
+            store.add(stats.collect(minute));
+            ++collects;
+            std::this_thread::sleep_for(1ms);
+        }
+    });
+    std::vector<double> per_add(threads);
+    std::vector<std::thread> adders;
+    for (int t = 0; t < threads; ++t) {
+        adders.emplace_back([&, t] {
+            auto start = EventLoop::now();
+            for (int i = 0; i < adds; ++i) {
+                stats.add(DEMAND_PRESSES);
+                if (i % 8 == 0) stats.wait(std::chrono::seconds(i % 97));
+            }
+            per_add[t] = double((EventLoop::now() - start).count()) / adds;
+        });
+    }
+    for (auto& adder : adders) adder.join();
+    running = false;
+    collector.join();
+    DemandBucket rest = stats.collect(0);
+    uint64_t presses = rest.presses;
+    for (size_t n = 0; n < store.stored(0); ++n) presses += store.oldest(0, n).presses;
+    store.close();
+    unlink(path);
+    double worst = *std::max_element(per_add.begin(), per_add.end());
+    printf("Статистика: %.1f ns на брояч от %d нишки, %llu събирания, %s\n", worst, threads,
+           (unsigned long long)collects, presses == uint64_t(adds) * threads ? "без загуби" : "ЗАГУБИ");
+}
+
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+size_t residentBytes() {
+    long pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(statm);
+    return size_t(resident) * size_t(sysconf(_SC_PAGESIZE));
+}
+
+// The thread-per-sequence design for comparison: `count` threads that have
+// each started a sequence and are blocked, as a controller thread is
+// between phases. Resident memory per thread, not counting the stack
+// address space reserved for each.
+double blockedThreadBytes(int count) {
+    std::mutex mutex;
+    std::condition_variable condition;
+    int started = 0;
+    bool release = false;
+    size_t before = residentBytes();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < count; ++i) {
+        threads.emplace_back([&] {
+            PhaseEngine engine;
+            engine.start(PEDESTRIAN_PLAN, EventLoop::now());
+            std::unique_lock<std::mutex> lock(mutex);
+            started += 1;
+            condition.notify_all();
+            condition.wait(lock, [&] { return release; });
+        });
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [&] { return started == count; });
+    }
+    size_t after = residentBytes();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+    }
+    condition.notify_all();
+    for (auto& thread : threads) thread.join();
+    return double(after - before) / count;
+}
+
+// One handoff between two threads through an EventLoop each, the way a
+// button edge or a deadline reaches a blocked controller thread.
+double threadHandoffNs(int round_trips) {
+    EventLoop ping, pong;
+    std::thread partner([&] {
+        for (int i = 0; i < round_trips; ++i) {
+            ping.waitUntil(EventLoop::FOREVER);
+            pong.wake();
+        }
+    });
+    auto start = EventLoop::now();
+    for (int i = 0; i < round_trips; ++i) {
+        ping.wake();
+        pong.waitUntil(EventLoop::FOREVER);
+    }
+    double ns = double((EventLoop::now() - start).count()) / (2.0 * round_trips);
+    partner.join();
+    return ns;
+}
+
+double processCpuNs() {
+    timespec cpu;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    return cpu.tv_sec * 1e9 + cpu.tv_nsec;
+}
+
+// N crossings on one coroutine executor in virtual time. Frames per
+// sequence are taken with every sequence inside its walk countdown (the
+// sequence's frame plus the countdown's); resume cost and CPU per cycle
+// from `hours` of random presses; then cancelAll() as on shutdown, which
+// must leave no frame behind and every crossing in the safe state.
+void coroutineSequencer(double hours) {
+    printf("Корутини: един изпълнител, виртуално време, %.2f h\n", hours);
+    printf("%8s %12s %12s %12s %14s %12s %10s\n", "N", "байта/посл.", "резерв/посл.", "ns/събуждане",
+           "CPU us/цикъл", "цикли", "отменени");
+    for (int count : {1, 100, 1000, 10000}) {
+        using Crossing = CoroutineCrossing<BoardPins, CountingGpio>;
+        TimerExecutor executor(true);
+        std::vector<CountingGpio> gpios(count);
+        std::vector<std::unique_ptr<Crossing>> crossings;
+        for (int i = 0; i < count; ++i) crossings.emplace_back(new Crossing(executor, gpios[i]));
+
+        for (auto& crossing : crossings) executor.spawn(crossing->pedestrianSequence());
+        executor.run(10s);
+        double frame_bytes = double(executor.frames().in_use) / count;
+        double reserved_bytes = double(executor.frames().reserved()) / count;
+        executor.run();
+
+        for (int i = 0; i < count; ++i) {
+            executor.spawn(crossings[i]->serve(90s, uint64_t(i + 1)), &Crossing::finished, crossings[i].get());
+        }
+        uint64_t resumes = executor.resumes;
+        double cpu = processCpuNs();
+        auto start = EventLoop::now();
+        executor.run(executor.now() +
+                     std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(hours * 3600)));
+        double wall_ns = double((EventLoop::now() - start).count());
+        cpu = processCpuNs() - cpu;
+        resumes = executor.resumes - resumes;
+
+        executor.cancelAll();
+        executor.run();
+        uint64_t cycles = 0, cancelled = 0;
+        bool safe = executor.frames().frames == 0 && executor.active() == 0;
+        for (auto& crossing : crossings) {
+            cycles += crossing->cycles - 1;
+            cancelled += crossing->cancellations;
+            safe = safe && crossing->outputs == BoardPlan::SAFE;
+        }
+        printf("%8d %12.0f %12.0f %12.1f %14.2f %12llu %10llu%s\n", count, frame_bytes, reserved_bytes,
+               resumes ? wall_ns / resumes : 0.0, cycles ? cpu / cycles / 1000.0 : 0.0, (unsigned long long)cycles,
+               (unsigned long long)cancelled, safe ? "" : "  ОСТАНАЛИ РАМКИ");
+    }
+    pthread_attr_t attributes;
+    size_t stack = 0;
+    pthread_attr_init(&attributes);
+    pthread_attr_getstacksize(&attributes, &stack);
+    pthread_attr_destroy(&attributes);
+    printf("Нишка на последователност: %.0f байта резидентни (1000 блокирани нишки), %zu KiB резервиран стек, "
+           "предаване между нишки %.0f ns\n",
+           blockedThreadBytes(1000), stack >> 10, threadHandoffNs(20000));
+}
+#endif
+
+void threadingStrategies(int cycles) {
+    printf("Стратегии на нишките (x%d, %d цикъла):\n", STRATEGY_SPEEDUP, cycles);
+    printf("  %6s %12s %12s %12s %12s\n", "цикли", "CPU us/цикъл", "закъсн. p99", "закъсн. max", "натиск. p99");
+    strategyCase<CondVarSync, ScaledTiming<SteadyTiming, STRATEGY_SPEEDUP>>("condition_variable + sleep_until",
+                                                                            cycles);
+    strategyCase<PthreadSync, ScaledTiming<NanosleepTiming, STRATEGY_SPEEDUP>>(
+        "pthread + нишка за отброяване + clock_nanosleep", cycles);
+    strategyCase<EventSync, ScaledTiming<EventLoopTiming, STRATEGY_SPEEDUP>>("timerfd + eventfd", cycles);
+}
+
+constexpr int CONTROL_SPEEDUP = 100;
+
+using LoadTiming = ScaledTiming<EventLoopTiming, CONTROL_SPEEDUP>;
+
+ControlServer* load_server = nullptr;
+std::atomic<uint64_t> load_cycles{0};
+
+// Publishes every snapshot to the control server, as AppDisplay does.
+struct ControlDisplay {
+    void show(const DisplaySnapshot& snapshot) {
+        load_server->publish(ControlState{snapshot.phase, snapshot.seconds, snapshot.link, snapshot.phase >= 0,
+                                          load_cycles.load(), EventLoop::now().count()});
+    }
+};
+
+struct LoadEvents : NoEvents {
+    void sequenceFinished(std::chrono::nanoseconds) {
+        load_cycles.fetch_add(1);
+    }
+};
+
+using LoadController = TrafficController<BoardPins, EventSync, LoadTiming, CountingGpio, ControlDisplay, LoadEvents>;
+LoadController* load_controller = nullptr;
+
+void loadTrigger() {
+    load_controller->requestWalk();
+}
+
+bool loadPending() {
+    return load_controller->requestPending();
+}
+
+// One blocking client: sends `batch` frames at a time (one write or one
+// datagram) and waits for all the replies. Whenever a reply shows the
+// controller at rest with nothing pending the next batch carries a trigger,
+// so the queries land mid-sequence. Latency is per round trip.
+void controlClient(const char* name, int fd, int batch, std::chrono::nanoseconds duration) {
+    ControlRequest requests[ControlServer::DATAGRAM_FRAMES];
+    ControlReply replies[ControlServer::DATAGRAM_FRAMES];
+    Histogram latency;
+    uint64_t queries = 0, running = 0, id = 0;
+    bool idle = true;
+    auto start = EventLoop::now();
+    auto end = start + duration;
+    while (EventLoop::now() < end) {
+        for (int i = 0; i < batch; ++i) {
+            requests[i] = ControlRequest{CONTROL_MAGIC, CONTROL_VERSION, CONTROL_QUERY, uint32_t(++id)};
+        }
+        if (idle) requests[0].op = CONTROL_TRIGGER;
+
+        auto sent = EventLoop::now();
+        size_t length = batch * sizeof(ControlRequest);
+        if (send(fd, requests, length, MSG_NOSIGNAL) != ssize_t(length)) break;
+        size_t expected = batch * sizeof(ControlReply), received = 0;
+        while (received < expected) {
+            ssize_t n = recv(fd, reinterpret_cast<uint8_t*>(replies) + received, expected - received, 0);
+            if (n <= 0) break;
+            received += size_t(n);
+        }
+        if (received < expected) break;
+        latency.record(uint64_t((EventLoop::now() - sent).count()));
+
+        queries += uint64_t(batch);
+        for (int i = 0; i < batch; ++i) {
+            if (replies[i].flags & CONTROL_SEQUENCE_RUNNING) running += 1;
+        }
+        const ControlReply& last = replies[batch - 1];
+        idle = !(last.flags & (CONTROL_SEQUENCE_RUNNING | CONTROL_REQUEST_PENDING));
+    }
+    double seconds = (EventLoop::now() - start).count() / 1e9;
+    printf("  %-5s %6d %12.0f %10.1f %10.1f %9.1f%%\n", name, batch, queries / seconds, latency.percentile(50) / 1000.0,
+           latency.percentile(99) / 1000.0, queries > 0 ? 100.0 * running / queries : 0.0);
+}
+
+// Load on the control API while a controller runs CONTROL_SPEEDUP times
+// faster than real time on a counting GPIO: one client at a time over UDP
+// and the Unix socket, one frame and a full datagram per round trip.
+void controlLoad(std::chrono::nanoseconds per_case) {
+    const char* path = "/tmp/trafficBench.control";
+    ControlServer server(&loadTrigger, &loadPending);
+    if (!server.listenUnix(path) || !server.listenUdp(0)) {
+        printf("Управление: сокетите не могат да бъдат отворени\n");
+        return;
+    }
+    load_server = &server;
+    LoadTiming timing;
+    CountingGpio gpio;
+    ControlDisplay display;
+    LoadController controller(timing, gpio, display);
+    load_controller = &controller;
+    controller.setup();
+
+    std::thread serving([&server] { server.run(); });
+    std::thread running([&controller] { controller.run(); });
+
+    printf("Контролен API под натоварване (x%d, %.1f s на случай):\n", CONTROL_SPEEDUP, per_case.count() / 1e9);
+    printf("  %-5s %6s %12s %10s %10s %10s\n", "", "пакет", "заявки/s", "p50 us", "p99 us", "в цикъл");
+    for (int batch : {1, ControlServer::DATAGRAM_FRAMES}) {
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(server.udpPort());
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        timeval timeout = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+            controlClient("udp", fd, batch, per_case);
+        }
+        close(fd);
+    }
+    for (int batch : {1, ControlServer::DATAGRAM_FRAMES}) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+            controlClient("unix", fd, batch, per_case);
+        }
+        close(fd);
+    }
+
+    controller.stop();
+    running.join();
+    server.stop();
+    serving.join();
+    printf("  сървър: %llu заявки в %llu пакета, %llu цикъла\n", (unsigned long long)server.requests,
+           (unsigned long long)server.batches, (unsigned long long)load_cycles.load());
+    load_controller = nullptr;
+    load_server = nullptr;
+}
+
+void ignoreWindow(std::chrono::nanoseconds, std::chrono::nanoseconds) {}
+
+// Several controllers on one machine, as separate processes talking UDP on
+// loopback: the leader here, `followers` forked children with their clocks
+// skewed by known amounts. Each child reports its estimate through a pipe;
+// the error is the estimate minus the true offset.
+void waveLoopback(int followers, std::chrono::nanoseconds run_for) {
+    GreenWave leader(&ignoreWindow);
+    if (!leader.lead(0, 90s, 0s, "127.0.0.1")) {
+        printf("Координация: UDP портът не може да бъде отворен\n");
+        return;
+    }
+    std::vector<pid_t> children;
+    std::vector<int> pipes;
+    std::vector<std::chrono::nanoseconds> skews;
+    for (int i = 0; i < followers; ++i) {
+        auto skew = std::chrono::nanoseconds(int64_t(i + 1) * 1234567891 * (i % 2 == 0 ? 1 : -1));
+        int channel[2];
+        if (pipe(channel) < 0) break;
+        pid_t child = fork();
+        if (child == 0) {
+            close(channel[0]);
+            GreenWave node(&ignoreWindow);
+            node.skew = skew;
+            node.poll = 100ms;
+            node.node = uint32_t(i + 1);
+            int64_t report[3] = {0, 0, 0};
+            if (node.follow("127.0.0.1", leader.port(), 0s)) {
+                std::thread stopper([&node, run_for] {
+                    std::this_thread::sleep_for(run_for);
+                    node.stop();
+                });
+                node.run();
+                stopper.join();
+                report[0] = node.offsetToLeader().count();
+                report[1] = node.filter.count() > 0 ? node.filter.best().delay.count() : 0;
+                report[2] = int64_t(node.exchanges);
+            }
+            ssize_t written = write(channel[1], report, sizeof(report));
+            (void)written;
+            _exit(0);
+        }
+        close(channel[1]);
+        if (child < 0) {
+            close(channel[0]);
+            break;
+        }
+        children.push_back(child);
+        pipes.push_back(channel[0]);
+        skews.push_back(skew);
+    }
+
+    std::thread serving([&leader] { leader.run(); });
+    printf("Координация на loopback: %zu процеса, %.1f s:\n", children.size(), run_for.count() / 1e9);
+    printf("  %4s %14s %14s %12s %10s\n", "възел", "изкривяване ms", "оценка ms", "грешка us", "обмени");
+    Histogram errors;
+    for (size_t i = 0; i < children.size(); ++i) {
+        int64_t report[3] = {0, 0, 0};
+        ssize_t n = read(pipes[i], report, sizeof(report));
+        close(pipes[i]);
+        waitpid(children[i], nullptr, 0);
+        if (n != sizeof(report) || report[2] == 0) {
+            printf("  %4zu без отговор\n", i + 1);
+            continue;
+        }
+        // The leader's clock minus the follower's is minus its skew.
+        double error_us = (report[0] + skews[i].count()) / 1000.0;
+        errors.record(uint64_t(std::abs(report[0] + skews[i].count())));
+        printf("  %4zu %14.3f %14.3f %12.1f %10lld\n", i + 1, skews[i].count() / 1e6, report[0] / 1e6, error_us,
+               (long long)report[2]);
+    }
+    leader.stop();
+    serving.join();
+    printf("  |грешка|: p50 %.1f us, max %.1f us; водещият отговори на %llu заявки\n", errors.percentile(50) / 1000.0,
+           errors.maximum() / 1000.0, (unsigned long long)leader.answered);
+}
+
+// The NTP exchange on a modelled network: each leg takes a fixed 100 us plus
+// an exponential queueing delay, independently, so the legs are asymmetric.
+// Returns |estimate - true offset| after `exchanges` exchanges through the
+// same filter the nodes use.
+std::chrono::nanoseconds modelledSyncError(uint64_t& rng, int exchanges, std::chrono::nanoseconds queueing) {
+    auto random = [&rng] {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return double((rng >> 11) + 1) / double(1ull << 53);
+    };
+    auto leg = [&] { return 100us + std::chrono::nanoseconds(int64_t(-std::log(random()) * queueing.count())); };
+    auto truth = std::chrono::nanoseconds(int64_t((random() - 0.5) * 20e9));
+    ClockFilter filter;
+    auto t1 = std::chrono::nanoseconds(0);
+    for (int i = 0; i < exchanges; ++i) {
+        auto t2 = t1 + truth + leg();
+        auto t3 = t2 + 20us;
+        auto t4 = t3 - truth + leg();
+        filter.add(clockSample(t1, t2, t3, t4));
+        t1 += 1s;
+    }
+    auto error = filter.best().offset - truth;
+    return error.count() < 0 ? -error : error;
+}
+
+// A corridor of crossings running the board's plan, 150 m blocks (11 s at
+// 50 km/h, 20 cars): pedestrian windows at random offsets against a green
+// wave, and a green wave with every crossing's window off by a modelled
+// clock-sync error.
+void greenWaveCorridor(int crossings) {
+    CorridorModel model = {crossings, 11s, 90s, carsHeld(PEDESTRIAN_PLAN, SIGNALS), 2s, 20, 1h};
+    uint64_t rng = 0x2545F4914F6CDD1Dull;
+
+    Histogram sync_error;
+    for (int i = 0; i < 1000; ++i) sync_error.record(uint64_t(modelledSyncError(rng, 8, 2ms).count()));
+
+    CorridorResult random_offsets = {0, 0, 0};
+    const int samples = 20;
+    for (int sample = 0; sample < samples; ++sample) {
+        std::vector<std::chrono::nanoseconds> offsets;
+        for (int i = 0; i < crossings; ++i) {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            offsets.push_back(std::chrono::nanoseconds(int64_t(rng % uint64_t(model.cycle.count()))));
+        }
+        CorridorResult result = simulateCorridor(model, offsets);
+        random_offsets.vehicles += result.vehicles;
+        random_offsets.travel_seconds += result.travel_seconds / samples;
+        random_offsets.stops += result.stops / samples;
+    }
+    random_offsets.vehicles /= samples;
+
+    std::vector<std::chrono::nanoseconds> wave = waveOffsets(model);
+    CorridorResult exact = simulateCorridor(model, wave);
+    std::vector<std::chrono::nanoseconds> skewed = wave;
+    for (auto& offset : skewed) {
+        auto error = modelledSyncError(rng, 8, 2ms);
+        offset += (rng & 1) ? error : -error;
+    }
+    CorridorResult synced = simulateCorridor(model, skewed);
+
+    printf("Зелена вълна: %d кръстовища през %lld s (%d коли), цикъл %lld s, коли спрени %lld s на цикъл\n", crossings,
+           (long long)std::chrono::duration_cast<std::chrono::seconds>(model.travel).count(), model.storage,
+           (long long)std::chrono::duration_cast<std::chrono::seconds>(model.cycle).count(),
+           (long long)std::chrono::duration_cast<std::chrono::seconds>(model.held).count());
+    printf("  грешка на синхронизацията (8 обмена, опашка 2 ms): p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           sync_error.percentile(50) / 1000.0, sync_error.percentile(99) / 1000.0, sync_error.maximum() / 1000.0);
+    printf("  %-26s %10s %10s %10s %10s\n", "", "коли/h", "печалба", "път s", "спирания");
+    auto row = [&random_offsets](const char* name, const CorridorResult& result) {
+        printf("  %-26s %10llu %9.1f%% %10.1f %10.2f\n", name, (unsigned long long)result.vehicles,
+               100.0 * (double(result.vehicles) / double(random_offsets.vehicles) - 1), result.travel_seconds,
+               result.stops);
+    };
+    row("случайни отмествания", random_offsets);
+    row("зелена вълна", exact);
+    row("зелена вълна + грешка", synced);
+}
+
+int main(int argc, char** argv) {
+    int workers = std::thread::hardware_concurrency();
+    double hours = 1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--workers") == 0) {
+            workers = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--hours") == 0) {
+            hours = std::atof(argv[i + 1]);
+        }
+    }
+    if (workers < 1) workers = 1;
+
+    metricsOverhead(1000000);
+    renderTime(1000);
+    transportFrames(1000);
+    logCallCost(2000);
+    bounceStorm(10, 200, 100us);
+    traceCost(1000000);
+    linkDetection(10000);
+    demandCost(1000000, 4);
+    threadingStrategies(50);
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+    coroutineSequencer(hours);
+#endif
+    controlLoad(2s);
+    waveLoopback(3, 2s);
+    greenWaveCorridor(8);
+    runtimeScaling(workers, hours);
+    return 0;
+}
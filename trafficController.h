@@ -0,0 +1,759 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
+#include "buttonEdges.h"
+#include "eventLoop.h"
+#include "phaseEngine.h"
+#include "trafficPlan.h"
+#include "timingPlans.h"
+#include "tripleBuffer.h"
+
+// What the display shows. The controller publishes one on every phase,
+// countdown tick and link change.
+struct DisplaySnapshot {
+    int8_t phase;
+    int8_t seconds;
+    bool link;
+};
+
+// Where pedestrian service may start when crossings are coordinated: at
+// `origin` plus any whole number of `cycle`s, on the controller's clock. A
+// zero cycle means whenever a request comes.
+struct ServiceWindow {
+    std::chrono::nanoseconds cycle;
+    std::chrono::nanoseconds origin;
+};
+
+// Press times waiting for the next walk phase, for the press-to-walk
+// latency. Fixed size so the controller never allocates for them: past
+// CAPACITY a press is only counted, the ones kept being the longest waits.
+class WaitingPresses {
+public:
+    static constexpr size_t CAPACITY = 32;
+
+    void push(std::chrono::nanoseconds pressed) {
+        if (kept < CAPACITY) {
+            presses[kept++] = pressed;
+        } else {
+            overflowed += 1;
+        }
+    }
+
+    const std::chrono::nanoseconds* begin() const {
+        return presses;
+    }
+
+    const std::chrono::nanoseconds* end() const {
+        return presses + kept;
+    }
+
+    void clear() {
+        kept = 0;
+        overflowed = 0;
+    }
+
+    // Every press waiting, kept or not.
+    size_t size() const {
+        return kept + overflowed;
+    }
+
+private:
+    std::chrono::nanoseconds presses[CAPACITY];
+    size_t kept = 0;
+    size_t overflowed = 0;
+};
+
+// FIXED drops presses made during a cycle and always holds car green for the
+// first phase; DEMAND latches them for the next cycle and counts the time
+// since the last cycle towards the minimum car green.
+enum ServiceMode { SERVICE_FIXED, SERVICE_DEMAND };
+
+// Timing policies: now(), sleepUntil(deadline) returning false when wake()
+// cut the sleep short, and wake(). The first two cannot be woken.
+
+class SteadyTiming {
+public:
+    std::chrono::nanoseconds now() {
+        return std::chrono::steady_clock::now().time_since_epoch();
+    }
+
+    bool sleepUntil(std::chrono::nanoseconds deadline) {
+        std::this_thread::sleep_until(
+            std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(deadline)));
+        return true;
+    }
+
+    void wake() {}
+};
+
+class NanosleepTiming {
+public:
+    std::chrono::nanoseconds now() {
+        return EventLoop::now();
+    }
+
+    bool sleepUntil(std::chrono::nanoseconds deadline) {
+        timespec ts;
+        ts.tv_sec = deadline.count() / 1000000000;
+        ts.tv_nsec = deadline.count() % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+        }
+        return true;
+    }
+
+    void wake() {}
+};
+
+class EventLoopTiming {
+public:
+    std::chrono::nanoseconds now() {
+        return EventLoop::now();
+    }
+
+    bool sleepUntil(std::chrono::nanoseconds deadline) {
+        return loop.waitUntil(deadline);
+    }
+
+    void wake() {
+        loop.wake();
+    }
+
+private:
+    EventLoop loop;
+};
+
+// Forwards to a concrete (final) Hal, so the calls are not virtual.
+template <class H>
+class HalTiming {
+public:
+    explicit HalTiming(H& hal) : hal(hal) {}
+
+    std::chrono::nanoseconds now() {
+        return hal.now();
+    }
+
+    bool sleepUntil(std::chrono::nanoseconds deadline) {
+        return hal.sleepUntil(deadline);
+    }
+
+    void wake() {
+        hal.wake();
+    }
+
+private:
+    H& hal;
+};
+
+// Runs another timing policy `Speedup` times faster than real time, so the
+// real threads and sleeps of a variant can be benchmarked over many cycles.
+template <class Base, int Speedup>
+class ScaledTiming {
+public:
+    std::chrono::nanoseconds now() {
+        return base.now() * Speedup;
+    }
+
+    bool sleepUntil(std::chrono::nanoseconds deadline) {
+        if (deadline == EventLoop::FOREVER) return base.sleepUntil(deadline);
+        return base.sleepUntil(deadline / Speedup);
+    }
+
+    void wake() {
+        base.wake();
+    }
+
+private:
+    Base base;
+};
+
+// GPIO policy over a concrete (final) Hal.
+template <class H>
+class HalGpio {
+public:
+    explicit HalGpio(H& hal) : hal(hal) {}
+
+    void configure(uint32_t pins) {
+        hal.configureOutputs(pins);
+    }
+
+    void write(uint32_t set_mask, uint32_t clear_mask) {
+        hal.writePins(set_mask, clear_mask);
+    }
+
+private:
+    H& hal;
+};
+
+// GPIO policy that only counts, for benchmarking the rest of a variant.
+struct CountingGpio {
+    void configure(uint32_t) {}
+
+    void write(uint32_t, uint32_t) {
+        writes += 1;
+    }
+
+    uint64_t writes = 0;
+};
+
+// Synchronisation policies: how the button side hands a press to a waiting
+// controller (notify/wait) and how a countdown phase is run.
+
+// std::mutex + std::condition_variable; the countdown runs on the
+// controller thread.
+class CondVarSync {
+public:
+    template <class Timing>
+    void notify(Timing&) {
+        { std::lock_guard<std::mutex> lock(mutex); }
+        condition.notify_all();
+    }
+
+    template <class Timing, class Ready>
+    void wait(Timing&, Ready ready) {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, ready);
+    }
+
+    template <class F>
+    void countdown(F&& run) {
+        run();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable condition;
+};
+
+// pthread mutex + condition, and a thread created and joined for every
+// countdown phase.
+class PthreadSync {
+public:
+    PthreadSync() {
+        pthread_mutex_init(&mutex, nullptr);
+        pthread_cond_init(&condition, nullptr);
+    }
+
+    ~PthreadSync() {
+        pthread_cond_destroy(&condition);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    PthreadSync(const PthreadSync&) = delete;
+    PthreadSync& operator=(const PthreadSync&) = delete;
+
+    template <class Timing>
+    void notify(Timing&) {
+        pthread_mutex_lock(&mutex);
+        pthread_cond_broadcast(&condition);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    template <class Timing, class Ready>
+    void wait(Timing&, Ready ready) {
+        pthread_mutex_lock(&mutex);
+        while (!ready()) pthread_cond_wait(&condition, &mutex);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    template <class F>
+    void countdown(F&& run) {
+        pthread_t thread;
+        auto body = [](void* arg) -> void* {
+            (*static_cast<F*>(arg))();
+            return nullptr;
+        };
+        if (pthread_create(&thread, nullptr, body, &run) != 0) {
+            run();
+            return;
+        }
+        threads_created += 1;
+        pthread_join(thread, nullptr);
+    }
+
+    uint64_t threads_created = 0;
+
+private:
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+};
+
+// No locks: notify() is the timing policy's wake(), which the sleeping
+// controller cannot miss. Safe from a signal handler with EventLoop timing.
+class EventSync {
+public:
+    template <class Timing>
+    void notify(Timing& timing) {
+        timing.wake();
+    }
+
+    template <class Timing, class Ready>
+    void wait(Timing& timing, Ready ready) {
+        if (!ready()) timing.sleepUntil(EventLoop::FOREVER);
+    }
+
+    template <class F>
+    void countdown(F&& run) {
+        run();
+    }
+};
+
+// Display policy that shows nothing.
+struct NullDisplay {
+    void show(const DisplaySnapshot&) {}
+};
+
+// Hooks for logging and metrics; the defaults compile to nothing. All are
+// called on the controller thread.
+struct NoEvents {
+    void debounced(std::chrono::nanoseconds) {}
+    void buttonIgnored() {}
+    void buttonServed() {}
+    void buttonLatched() {}
+    void buttonPressed() {}
+    void sequenceStarted(std::chrono::nanoseconds) {}
+    void planAdopted(const PlanSnapshot&) {}
+    void walked(std::chrono::nanoseconds) {}
+    void countdown(int) {}
+    void overshoot(std::chrono::nanoseconds) {}
+    void sequenceFinished(std::chrono::nanoseconds) {}
+    void traceEdge(const ButtonEdge&) {}
+    void traceLink(std::chrono::nanoseconds, bool) {}
+    void traceRequest(std::chrono::nanoseconds) {}
+    void tracePhase(std::chrono::nanoseconds, uint32_t) {}
+};
+
+// The pedestrian crossing controller, with everything that differed between
+// the old variants turned into policies picked at compile time:
+//   Pins    - BoardPins-like struct of constexpr pin numbers
+//   Sync    - CondVarSync, PthreadSync or EventSync
+//   Timing  - SteadyTiming, NanosleepTiming, EventLoopTiming, HalTiming<H>
+//   Gpio    - configure(mask), write(set, clear)
+//   Display - show(const DisplaySnapshot&)
+//   Events  - NoEvents-like hooks
+// Button edges may arrive from any one thread through onButtonEdge(); all
+// other calls belong to the thread that runs run(), or that calls poll()
+// instead.
+template <class Pins, class Sync, class Timing, class Gpio, class Display, class Events = NoEvents>
+class TrafficController {
+public:
+    using Plan = TrafficPlan<Pins>;
+
+    static constexpr size_t EDGE_RING = 256;
+    static constexpr std::chrono::milliseconds BUTTON_LOCKOUT{300};
+
+    TrafficController(Timing& timing, Gpio& gpio, Display& display)
+        : timing(timing), gpio(gpio), display(display) {}
+
+    // Outputs configured and forced to the safe state; nothing else is
+    // touched, so this can run before the rest of the program starts.
+    void setup() {
+        gpio.configure(Plan::OUTPUTS);
+        setPhase(Plan::SAFE);
+    }
+
+    // Takes the outputs from the safe state to rest through the start-up
+    // plan; run() does it first if nobody has. False if stopped meanwhile.
+    bool startup() {
+        if (!runPlan(Plan::STARTUP)) return false;
+        reachRest();
+        return true;
+    }
+
+    // Interrupt side: queue the edge and nothing else; bounce is left to
+    // the debouncer on the controller thread. While the controller sleeps
+    // without draining (SteadyTiming, NanosleepTiming) a full ring gives
+    // up its oldest edges, never the last press.
+    void onButtonEdge(const ButtonEdge& edge) {
+        edges.push(edge);
+        sync.notify(timing);
+    }
+
+    // With the link down the controller finishes the running sequence (or
+    // start-up), if any, and stops. The stop is the controller thread's
+    // decision: deciding here from timer_running raced with a sequence
+    // being taken but not yet marked running.
+    void setLink(bool up) {
+        link_changed_at.store(timing.now().count(), std::memory_order_relaxed);
+        link = up;
+        sync.notify(timing);
+    }
+
+    void stop() {
+        work = false;
+        sync.notify(timing);
+        timing.wake();
+    }
+
+    bool working() const {
+        return work;
+    }
+
+    // Waits for requests and runs a pedestrian sequence for each until
+    // stop(), or until the link is down with nothing running.
+    void run() {
+        if (!at_rest && !startup()) return;
+        while (work) {
+            handleButtonEdges();
+            publishLink();
+            if (!observeLink()) {
+                work = false;
+                break;
+            }
+            if (!pedestrian_request) {
+                sync.wait(timing, [this] {
+                    return !work || pedestrian_request || remote_request || !edges.empty() || link != shown.link;
+                });
+                continue;
+            }
+            // The request stays pending until the window, so presses
+            // meanwhile are handled as presses on a waiting request.
+            if (!waitForWindow()) continue;
+            pedestrian_request = false;
+
+            pedestrianSequence();
+        }
+    }
+
+    // run() for a host that owns the clock and cannot give each controller
+    // a thread (intersectionRuntime.h): does what run() would have done by
+    // timing.now() without sleeping and returns when it next has something
+    // due, FOREVER if only an input can change that. Inputs arrive as for
+    // run(); the host calls poll() again after delivering them.
+    std::chrono::nanoseconds poll() {
+        if (!work) return EventLoop::FOREVER;
+        auto now = timing.now();
+        while (engine.running() && engine.deadline() <= now) {
+            applyStep(engine.deadline());
+            if (engine.running()) continue;
+            if (timer_running) {
+                finishSequence();
+            } else {
+                reachRest();
+            }
+        }
+        handleButtonEdges();
+        publishLink();
+        if (engine.running()) return engine.deadline();
+        if (!at_rest) {
+            beginPlan(Plan::STARTUP);
+            return engine.deadline();
+        }
+        if (!observeLink()) {
+            work = false;
+            return EventLoop::FOREVER;
+        }
+        if (!pedestrian_request) return EventLoop::FOREVER;
+        auto opens = windowOpens(now);
+        if (opens > now) return opens;
+        pedestrian_request = false;
+        startSequence();
+        beginPlan(pedestrianPlan());
+        return engine.deadline();
+    }
+
+    // The trace hooks are called from here, on the controller thread, for
+    // inputs that arrived from the others: the recorder has one writer.
+    void handleButtonEdges() {
+        observeLink();
+        ButtonEdge edge;
+        while (edges.pop(edge)) {
+            events.traceEdge(edge);
+            if (!debouncer.accept(edge)) continue;
+            events.debounced(timing.now() - edge.timestamp);
+            acceptPress(edge.timestamp);
+        }
+        if (remote_request.exchange(false)) {
+            events.traceRequest(std::chrono::nanoseconds(remote_requested_at.load(std::memory_order_relaxed)));
+            acceptPress(timing.now());
+        }
+    }
+
+    // A press that did not come from the button (control API): no edge, no
+    // debouncing, otherwise handled like one. Callable from any thread.
+    void requestWalk() {
+        remote_requested_at.store(timing.now().count(), std::memory_order_relaxed);
+        remote_request = true;
+        sync.notify(timing);
+    }
+
+    // Coordination (greenWave.h): callable from any thread; takes effect
+    // for the next request.
+    void setServiceWindow(const ServiceWindow& window) {
+        windows.publish(window);
+    }
+
+    // Plans published here (timingPlans.h) replace the compiled-in
+    // pedestrian plan: a new one is taken at the start of the next
+    // sequence, or at the next phase boundary of a running one if only its
+    // durations changed. This controller is the cell's only reader. Set
+    // before run().
+    void setPlans(PlanCell* cell) {
+        plans = cell;
+    }
+
+    bool requestPending() const {
+        return pedestrian_request;
+    }
+
+    bool busy() const {
+        return timer_running;
+    }
+
+    // Takes a pending request, for callers that drive the controller
+    // themselves instead of through run().
+    bool takeRequest() {
+        return pedestrian_request.exchange(false);
+    }
+
+    void pedestrianSequence() {
+        startSequence();
+        if (!runPlan(pedestrianPlan())) return;
+        finishSequence();
+    }
+
+    ServiceMode service_mode = SERVICE_DEMAND;
+    Sync sync;
+    Events events;
+
+    // Presses still waiting for a walk phase.
+    WaitingPresses waiting_presses;
+    Debouncer debouncer{BUTTON_LOCKOUT};
+    std::chrono::nanoseconds countdown_max_lateness{0};
+
+    uint64_t droppedEdges() const {
+        return edges.droppedCount();
+    }
+
+private:
+    void acceptPress(std::chrono::nanoseconds pressed) {
+        if (!link) {
+            events.buttonIgnored();
+            return;
+        }
+        if (service_mode == SERVICE_FIXED && (pedestrian_request || timer_running)) {
+            events.buttonIgnored();
+            return;
+        }
+        waiting_presses.push(pressed);
+
+        if (service_mode == SERVICE_DEMAND) {
+            if (timer_running && !walk_begun) {
+                events.buttonServed();
+                return;
+            }
+            if (pedestrian_request) return;
+        }
+
+        pedestrian_request = true;
+        request_pressed_at = pressed;
+        if (timer_running) {
+            events.buttonLatched();
+        } else {
+            events.buttonPressed();
+        }
+    }
+
+    bool observeLink() {
+        bool up = link;
+        if (up != traced_link) {
+            traced_link = up;
+            events.traceLink(std::chrono::nanoseconds(link_changed_at.load(std::memory_order_relaxed)), up);
+        }
+        return up;
+    }
+
+    const PhasePlan& pedestrianPlan() {
+        const PlanSnapshot* latest = plans != nullptr ? plans->current() : nullptr;
+        if (latest != nullptr && latest != held_plan) adopt(latest);
+        return held_plan != nullptr ? held_plan->plan : Plan::PEDESTRIAN;
+    }
+
+    // At a phase boundary: the running plan may give way only to one with
+    // the same phases, the engine then times the phase it just entered and
+    // every later one by the new plan.
+    void adoptAtBoundary() {
+        const PlanSnapshot* latest = plans != nullptr ? plans->current() : nullptr;
+        if (latest == nullptr || latest == held_plan || held_plan == nullptr ||
+            !engine.runs(held_plan->plan) || !samePhases(latest->plan, held_plan->plan)) {
+            return;
+        }
+        adopt(latest);
+        engine.adopt(latest->plan);
+    }
+
+    void adopt(const PlanSnapshot* latest) {
+        plans->hold(latest);
+        held_plan = latest;
+        events.planAdopted(*latest);
+    }
+
+    void setPhase(uint32_t outputs) {
+        events.tracePhase(timing.now(), outputs);
+        gpio.write(outputs, Plan::OUTPUTS & ~outputs);
+    }
+
+    void show(int phase, int seconds) {
+        shown = DisplaySnapshot{int8_t(phase), int8_t(seconds), link};
+        display.show(shown);
+    }
+
+    void publishLink() {
+        if (shown.link != link) show(shown.phase, shown.seconds);
+    }
+
+    bool waitUntil(std::chrono::nanoseconds deadline) {
+        while (work) {
+            if (timing.sleepUntil(deadline)) return true;
+            handleButtonEdges();
+            publishLink();
+        }
+        return false;
+    }
+
+    // When service may start, `now` or the next window after it.
+    std::chrono::nanoseconds windowOpens(std::chrono::nanoseconds now) {
+        windows.take(window);
+        if (window.cycle.count() <= 0) return now;
+        auto since = (now - window.origin) % window.cycle;
+        if (since.count() < 0) since += window.cycle;
+        if (since.count() == 0) return now;
+        return now - since + window.cycle;
+    }
+
+    bool waitForWindow() {
+        auto now = timing.now();
+        auto deadline = windowOpens(now);
+        if (deadline == now) return true;
+        while (work && link) {
+            if (timing.sleepUntil(deadline)) return true;
+            handleButtonEdges();
+            publishLink();
+        }
+        return false;
+    }
+
+    void beginWalk() {
+        walk_begun = true;
+        auto now = timing.now();
+        for (auto pressed : waiting_presses) events.walked(now - pressed);
+        waiting_presses.clear();
+    }
+
+    void showPhase() {
+        if (engine.phase().countdown) {
+            if (engine.remaining() == engine.phase().seconds) beginWalk();
+            events.countdown(engine.remaining());
+            show(int(engine.phaseIndex()), engine.remaining());
+        } else {
+            show(int(engine.phaseIndex()), -1);
+        }
+    }
+
+    void startSequence() {
+        events.sequenceStarted(timing.now() - request_pressed_at);
+        timer_running = true;
+        walk_begun = false;
+    }
+
+    void finishSequence() {
+        timer_running = false;
+        rest_since = timing.now();
+        events.sequenceFinished(countdown_max_lateness);
+    }
+
+    void reachRest() {
+        at_rest = true;
+        rest_since = timing.now();
+    }
+
+    // `plan` may be replaced mid-run (adoptAtBoundary) and freed after, so
+    // only the engine looks at it once started; its rest state is kept.
+    void beginPlan(const PhasePlan& plan) {
+        rest = plan.rest;
+        auto now = timing.now();
+        engine.start(plan, now, service_mode == SERVICE_DEMAND ? now - rest_since : std::chrono::nanoseconds(0));
+        setPhase(engine.outputs());
+        showPhase();
+    }
+
+    // Applies the engine step that was due at `deadline`.
+    void applyStep(std::chrono::nanoseconds deadline) {
+        auto lateness = timing.now() - deadline;
+        events.overshoot(lateness);
+        if (engine.phase().countdown && lateness > countdown_max_lateness) countdown_max_lateness = lateness;
+
+        switch (engine.advance()) {
+        case PhaseEngine::TICK:
+            showPhase();
+            break;
+        case PhaseEngine::PHASE:
+            adoptAtBoundary();
+            setPhase(engine.outputs());
+            showPhase();
+            break;
+        case PhaseEngine::DONE:
+            setPhase(rest);
+            show(-1, -1);
+            break;
+        }
+    }
+
+    // Sleeps until the engine's next deadline and applies it; false once
+    // stopped.
+    bool step() {
+        auto deadline = engine.deadline();
+        if (!waitUntil(deadline)) return false;
+        applyStep(deadline);
+        return true;
+    }
+
+    bool runPlan(const PhasePlan& plan) {
+        beginPlan(plan);
+        bool ok = true;
+        while (ok && engine.running()) {
+            if (engine.phase().countdown) {
+                sync.countdown([&] {
+                    while (ok && engine.running() && engine.phase().countdown) ok = step();
+                });
+            } else {
+                ok = step();
+            }
+        }
+        if (!ok) engine.stop();
+        return ok;
+    }
+
+    Timing& timing;
+    Gpio& gpio;
+    Display& display;
+
+    std::atomic<bool> work{true};
+    std::atomic<bool> pedestrian_request{false};
+    std::atomic<bool> timer_running{false};
+    std::atomic<bool> link{true};
+    std::atomic<bool> remote_request{false};
+    std::atomic<int64_t> link_changed_at{0};
+    std::atomic<int64_t> remote_requested_at{0};
+    EdgeRing<EDGE_RING> edges;
+    TripleBuffer<ServiceWindow> windows;
+    PlanCell* plans = nullptr;
+    const PlanSnapshot* held_plan = nullptr;
+    PhaseEngine engine;
+    uint32_t rest = 0;
+
+    ServiceWindow window = {std::chrono::nanoseconds(0), std::chrono::nanoseconds(0)};
+    DisplaySnapshot shown = {-1, -1, true};
+    bool walk_begun = false;
+    bool traced_link = true;
+    bool at_rest = false;
+    std::chrono::nanoseconds rest_since{0};
+    std::chrono::nanoseconds request_pressed_at{0};
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include "gpioPhase.h"
+#include "phaseEngine.h"
+
+// BCM pin numbers of one crossing's signal heads, button and buzzer.
+struct BoardPins {
+    static constexpr int CAR_GREEN  = 17;
+    static constexpr int CAR_YELLOW = 27;
+    static constexpr int CAR_RED    = 22;
+    static constexpr int PED_RED    = 25;
+    static constexpr int PED_GREEN  = 16;
+    static constexpr int BUTTON     = 26;
+    static constexpr int BUZZER     = 21;
+};
+
+// Every pin is a usable header GPIO, none is used twice and none is one of
+// the I2C1 lines (2, 3) the display sits on.
+template <class Pins>
+constexpr bool pinsValid() {
+    const int pins[] = {Pins::CAR_GREEN, Pins::CAR_YELLOW, Pins::CAR_RED, Pins::PED_RED,
+                        Pins::PED_GREEN, Pins::BUTTON,     Pins::BUZZER};
+    constexpr int count = sizeof(pins) / sizeof(pins[0]);
+    for (int i = 0; i < count; ++i) {
+        if (pins[i] < 0 || pins[i] > 27 || pins[i] == 2 || pins[i] == 3) return false;
+        for (int j = i + 1; j < count; ++j) {
+            if (pins[i] == pins[j]) return false;
+        }
+    }
+    return true;
+}
+
+// The output masks and pedestrian plan for a pin assignment, checked when
+// the template is instantiated.
+template <class Pins>
+struct TrafficPlan {
+    static_assert(pinsValid<Pins>(), "pin assignment reuses a pin or takes an I2C line");
+
+    static constexpr uint32_t LIGHTS = pinMask(Pins::CAR_GREEN) | pinMask(Pins::CAR_YELLOW) |
+                                       pinMask(Pins::CAR_RED) | pinMask(Pins::PED_RED) |
+                                       pinMask(Pins::PED_GREEN);
+    static constexpr uint32_t OUTPUTS = LIGHTS | pinMask(Pins::BUZZER);
+
+    static constexpr uint32_t CARS_GO   = pinMask(Pins::CAR_GREEN) | pinMask(Pins::PED_RED);
+    static constexpr uint32_t CARS_STOP = pinMask(Pins::CAR_YELLOW) | pinMask(Pins::PED_RED);
+    static constexpr uint32_t ALL_RED   = pinMask(Pins::CAR_RED) | pinMask(Pins::PED_RED);
+    static constexpr uint32_t PEDS_GO   = pinMask(Pins::CAR_RED) | pinMask(Pins::PED_GREEN) |
+                                          pinMask(Pins::BUZZER);
+
+    static constexpr SignalLayout SIGNALS = {
+        pinMask(Pins::CAR_GREEN), pinMask(Pins::CAR_YELLOW), pinMask(Pins::CAR_RED),
+        pinMask(Pins::PED_GREEN), pinMask(Pins::PED_RED),
+    };
+
+    static constexpr Phase PHASES[] = {
+        {CARS_GO,    5, false},
+        {CARS_STOP,  2, false},
+        {ALL_RED,    2, false},
+        {PEDS_GO,   20, true},
+        {ALL_RED,    5, false},
+        {CARS_STOP,  2, false},
+    };
+
+    static constexpr PhasePlan PEDESTRIAN = {PHASES, sizeof(PHASES) / sizeof(PHASES[0]), CARS_GO};
+
+    // What the outputs are forced to first thing at start-up, whatever a
+    // crashed predecessor left on them, and how the controller gets from
+    // there to rest: the same clearance and yellow that follow a walk.
+    static constexpr uint32_t SAFE = ALL_RED;
+
+    static constexpr Phase STARTUP_PHASES[] = {
+        {ALL_RED,    5, false},
+        {CARS_STOP,  2, false},
+    };
+
+    static constexpr PhasePlan STARTUP = {STARTUP_PHASES, sizeof(STARTUP_PHASES) / sizeof(STARTUP_PHASES[0]),
+                                          CARS_GO};
+
+    static_assert((OUTPUTS & pinMask(Pins::BUTTON)) == 0, "button pin is also an output");
+    static_assert(greensNeverTogether(PEDESTRIAN, SIGNALS), "car and pedestrian green overlap");
+    static_assert(yellowBetweenGreenAndRed(PEDESTRIAN, SIGNALS), "green and red without yellow between");
+    static_assert(validPlan(PEDESTRIAN, SIGNALS), "invalid pedestrian plan");
+    static_assert(greensNeverTogether(STARTUP, SIGNALS) && everyHeadLit(STARTUP, SIGNALS) &&
+                      yellowBetweenGreenAndRed(STARTUP, SIGNALS, SAFE),
+                  "invalid start-up plan");
+};
+
+using BoardPlan = TrafficPlan<BoardPins>;
+
+constexpr int CAR_GREEN      = BoardPins::CAR_GREEN;
+constexpr int CAR_YELLOW     = BoardPins::CAR_YELLOW;
+constexpr int CAR_RED        = BoardPins::CAR_RED;
+constexpr int PED_RED        = BoardPins::PED_RED;
+constexpr int PED_GREEN      = BoardPins::PED_GREEN;
+constexpr int BUTTON_PIN     = BoardPins::BUTTON;
+constexpr int BUZZER_PIN     = BoardPins::BUZZER;
+
+constexpr uint32_t LIGHT_PINS  = BoardPlan::LIGHTS;
+constexpr uint32_t OUTPUT_PINS = BoardPlan::OUTPUTS;
+
+constexpr uint32_t PHASE_CARS_GO   = BoardPlan::CARS_GO;
+constexpr uint32_t PHASE_CARS_STOP = BoardPlan::CARS_STOP;
+constexpr uint32_t PHASE_ALL_RED   = BoardPlan::ALL_RED;
+constexpr uint32_t PHASE_PEDS_GO   = BoardPlan::PEDS_GO;
+
+constexpr SignalLayout SIGNALS = BoardPlan::SIGNALS;
+constexpr PhasePlan PEDESTRIAN_PLAN = BoardPlan::PEDESTRIAN;
@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <unistd.h>
+#include "demandStats.h"
+
+// Reads the demand series written with --stats. The query picks the finest
+// ring that still reaches back to the start of the range and is no finer
+// than the grouping asks for, finds the start with a binary search and
+// walks forward, so a year grouped by day reads 8760 hourly buckets out of
+// the page cache. --generate fills a fresh file with synthetic demand
+// ending now, to try the queries without a year of presses.
+
+enum Grouping { BY_MINUTE, BY_QUARTER, BY_HOUR, BY_DAY, BY_WEEKDAY, BY_CLOCK };
+
+const char* const GROUPING_NAMES[] = {"minute", "quarter", "hour", "day", "weekday", "clock"};
+const char* const WEEKDAYS[] = {"нд", "пн", "вт", "ср", "чт", "пт", "сб"};
+
+uint32_t nowMinute() {
+    auto wall = std::chrono::system_clock::now().time_since_epoch();
+    return uint32_t(std::chrono::duration_cast<std::chrono::minutes>(wall).count());
+}
+
+struct tm localMinute(uint32_t minute) {
+    time_t seconds = time_t(minute) * 60;
+    struct tm local;
+    localtime_r(&seconds, &local);
+    return local;
+}
+
+// First bucket in the ring that starts at or after `minute`.
+size_t lowerBound(const DemandStore& store, int ring, uint32_t minute) {
+    size_t low = 0, high = store.stored(ring);
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (store.oldest(ring, middle).start + store.oldest(ring, middle).span <= minute) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+int pickRing(const DemandStore& store, Grouping by, uint32_t from) {
+    int finest_allowed = 0;
+    int coarsest_allowed = by == BY_MINUTE ? 0 : by == BY_QUARTER ? 1 : 2;
+    for (int ring = finest_allowed; ring < coarsest_allowed; ++ring) {
+        if (store.stored(ring) > 0 && store.oldest(ring, 0).start <= from) return ring;
+    }
+    return coarsest_allowed;
+}
+
+long groupKey(Grouping by, const DemandBucket& bucket) {
+    if (by == BY_MINUTE || by == BY_QUARTER) return bucket.start;
+    if (by == BY_HOUR) return bucket.start / 60 * 60;
+    struct tm local = localMinute(bucket.start);
+    if (by == BY_WEEKDAY) return local.tm_wday;
+    if (by == BY_CLOCK) return local.tm_hour;
+    return long(local.tm_year + 1900) * 10000 + (local.tm_mon + 1) * 100 + local.tm_mday;
+}
+
+// Pads by characters rather than bytes, for the Cyrillic headings.
+void column(const char* text, int width, bool left = false) {
+    int characters = 0;
+    for (const char* c = text; *c; ++c) characters += (*c & 0xC0) != 0x80;
+    if (left) printf("%s", text);
+    for (int i = characters; i < width; ++i) putchar(' ');
+    if (!left) printf("%s", text);
+}
+
+void printLabel(Grouping by, long key) {
+    char label[32];
+    if (by == BY_WEEKDAY) {
+        snprintf(label, sizeof(label), "%s", WEEKDAYS[key]);
+    } else if (by == BY_CLOCK) {
+        snprintf(label, sizeof(label), "%02ld:00", key);
+    } else if (by == BY_DAY) {
+        snprintf(label, sizeof(label), "%04ld-%02ld-%02ld", key / 10000, key / 100 % 100, key % 100);
+    } else {
+        struct tm local = localMinute(uint32_t(key));
+        strftime(label, sizeof(label), "%Y-%m-%d %H:%M", &local);
+    }
+    column(label, 17, true);
+}
+
+// Groups can outgrow a bucket's 16- and 32-bit counts, so they add up in
+// 64 bits.
+struct Row {
+    uint64_t presses = 0, requests = 0, ignored = 0, served = 0, remote = 0, cycles = 0;
+    uint64_t waits = 0, wait_seconds = 0, wait_max = 0;
+    uint64_t wait_histogram[8] = {};
+
+    void add(const DemandBucket& bucket) {
+        presses += bucket.presses;
+        requests += bucket.requests;
+        ignored += bucket.ignored;
+        served += bucket.served;
+        remote += bucket.remote;
+        cycles += bucket.cycles;
+        waits += bucket.waits;
+        wait_seconds += bucket.wait_seconds;
+        wait_max = std::max<uint64_t>(wait_max, bucket.wait_max);
+        for (int i = 0; i < 8; ++i) wait_histogram[i] += bucket.wait_histogram[i];
+    }
+};
+
+// Upper edge of the histogram bucket holding the 90th percentile wait.
+const char* p90(const Row& row) {
+    static char text[16];
+    uint64_t target = (row.waits * 9 + 9) / 10, seen = 0;
+    for (int i = 0; i < 8; ++i) {
+        seen += row.wait_histogram[i];
+        if (seen >= target) {
+            if (i == 7) return ">90";
+            snprintf(text, sizeof(text), "<%u", DEMAND_WAIT_EDGES[i]);
+            return text;
+        }
+    }
+    return "-";
+}
+
+void printRow(const Row& row) {
+    double ignored = row.presses ? 100.0 * row.ignored / row.presses : 0;
+    double mean = row.waits ? double(row.wait_seconds) / row.waits : 0;
+    printf(" %9llu %9llu %7.1f%% %9llu %7llu %7llu %7.1f %5s %5llu\n", (unsigned long long)row.presses,
+           (unsigned long long)row.requests, ignored, (unsigned long long)row.served, (unsigned long long)row.remote,
+           (unsigned long long)row.cycles, mean, row.waits ? p90(row) : "-", (unsigned long long)row.wait_max);
+}
+
+// Daytime demand with a morning and an evening peak; nights are empty and
+// so are not stored.
+bool generate(const char* path, size_t budget, int days) {
+    unlink(path);
+    DemandStore store;
+    if (!store.open(path, budget)) return false;
+    DemandStats stats;
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    auto next = [&state] {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+    uint32_t last = nowMinute();
+    for (uint32_t minute = last - uint32_t(days) * 1440; minute < last; ++minute) {
+        int clock = localMinute(minute / 60 * 60).tm_hour;
+        int rate = clock < 6 ? 0 : clock == 8 || clock == 17 ? 6 : clock < 22 ? 2 : 0;
+        for (int press = 0; rate > 0 && press < int(next() % uint64_t(2 * rate + 1)); ++press) {
+            stats.add(DEMAND_PRESSES);
+            if (next() % 4 == 0) {
+                stats.add(DEMAND_SERVED);
+                continue;
+            }
+            stats.add(DEMAND_REQUESTS);
+            stats.add(DEMAND_CYCLES);
+            stats.wait(std::chrono::seconds(next() % (rate > 2 ? 100 : 40)));
+        }
+        if (rate > 0 && next() % 30 == 0) stats.add(DEMAND_REMOTE);
+        if (rate > 0 && next() % 200 == 0) stats.add(DEMAND_IGNORED);
+        store.add(stats.collect(minute));
+    }
+    printf("Генерирани %d дни в %s (%zu байта)\n", days, path, store.bytes());
+    return true;
+}
+
+int usage(const char* program) {
+    printf("Употреба: %s ФАЙЛ [--days N] [--by minute|quarter|hour|day|weekday|clock] "
+           "[--generate ДНИ] [--budget MB]\n",
+           program);
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) return usage(argv[0]);
+    if (std::strcmp(argv[1], "--help") == 0) {
+        usage(argv[0]);
+        return 0;
+    }
+    const char* path = argv[1];
+    double days = 7;
+    Grouping by = BY_DAY;
+    int generate_days = 0;
+    double budget_mb = 8;
+    for (int i = 2; i < argc; i += 2) {
+        if (std::strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        }
+        if (i + 1 == argc) {
+            printf("Опцията %s няма стойност\n", argv[i]);
+            return usage(argv[0]);
+        }
+        if (std::strcmp(argv[i], "--days") == 0) {
+            days = std::atof(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--by") == 0) {
+            int g = BY_MINUTE;
+            while (g <= BY_CLOCK && std::strcmp(argv[i + 1], GROUPING_NAMES[g]) != 0) ++g;
+            if (g > BY_CLOCK) {
+                printf("Непознато групиране %s\n", argv[i + 1]);
+                return usage(argv[0]);
+            }
+            by = Grouping(g);
+        } else if (std::strcmp(argv[i], "--generate") == 0) {
+            generate_days = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--budget") == 0) {
+            budget_mb = std::atof(argv[i + 1]);
+        } else {
+            printf("Непозната опция %s\n", argv[i]);
+            return usage(argv[0]);
+        }
+    }
+    if (generate_days > 0 && !generate(path, size_t(budget_mb * (1 << 20)), generate_days)) {
+        printf("%s не може да бъде създаден\n", path);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    DemandStore store;
+    if (!store.open(path, 0, false)) {
+        printf("%s не е файл със статистика\n", path);
+        return 1;
+    }
+    uint32_t to = nowMinute() + 1;
+    uint32_t from = to - uint32_t(days * 1440);
+    int ring = pickRing(store, by, from);
+
+    std::map<long, Row> groups;
+    Row total;
+    size_t scanned = 0;
+    for (size_t n = lowerBound(store, ring, from); n < store.stored(ring); ++n) {
+        const DemandBucket& bucket = store.oldest(ring, n);
+        if (bucket.start >= to) break;
+        groups[groupKey(by, bucket)].add(bucket);
+        total.add(bucket);
+        scanned += 1;
+    }
+    double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    column(GROUPING_NAMES[by], 17, true);
+    const char* headings[] = {"натиск.", "заявки", "игнор.", "обслуж.", "отдал.", "цикли", "чакане", "p90", "макс"};
+    const int widths[] = {10, 10, 9, 10, 8, 8, 8, 6, 6};
+    for (int i = 0; i < 9; ++i) column(headings[i], widths[i]);
+    printf("\n");
+    for (const auto& group : groups) {
+        printLabel(by, group.first);
+        printRow(group.second);
+    }
+    column("общо", 17, true);
+    printRow(total);
+    uint32_t reach = store.stored(ring) > 0 ? store.oldest(ring, 0).start : to;
+    if (reach > from) {
+        printf("Кофите по %u мин стигат само %.1f дни назад\n", store.ring(ring).span, (to - reach) / 1440.0);
+    }
+    printf("Прегледани %zu кофи по %u мин за %.2f ms\n", scanned, store.ring(ring).span, elapsed_ms);
+    return 0;
+}
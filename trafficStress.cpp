@@ -0,0 +1,553 @@
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "histogram.h"
+#include "trafficController.h"
+
+// Stress and soak harness for the shared controller on simulated outputs.
+// Real threads do what the programs' threads do - one button edge producer,
+// a link monitor, a control client, SIGINT from outside - at randomised rates
+// while the controller runs SPEEDUP times faster than real time. Every
+// output transition, display snapshot and wake-up is checked as it happens.
+// A life ends when the link drops with nothing running, on SIGINT or when
+// time is up; the next one starts on a fresh controller, as the service
+// manager would restart the program. Build it with -fsanitize=thread or
+// -fsanitize=address,undefined as well.
+
+using namespace std::chrono_literals;
+
+constexpr int SPEEDUP = 100;
+
+struct StressOptions {
+    double hours = 0.01;
+    double bursts = 20;
+    int max_bounces = 30;
+    double floods = 0.2;
+    double remotes = 5;
+    double flaps = 0.1;
+    double sigints = 0.02;
+    std::chrono::nanoseconds late_bound = 50ms;
+    uint64_t seed = 1;
+};
+
+std::atomic<uint64_t> violations{0};
+
+void violation(const char* format, ...) {
+    if (violations.fetch_add(1) >= 20) return;
+    va_list args;
+    va_start(args, format);
+    printf("  НАРУШЕНИЕ: ");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+}
+
+class Random {
+public:
+    explicit Random(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull + 1) {}
+
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    double uniform() {
+        return double((next() >> 11) + 1) / double(1ull << 53);
+    }
+
+    // Real-time gap to the next event of a Poisson process at `rate`/s.
+    std::chrono::nanoseconds gap(double rate) {
+        if (rate <= 0) return EventLoop::FOREVER;
+        return std::chrono::nanoseconds(int64_t(-std::log(uniform()) / rate * 1e9));
+    }
+
+private:
+    uint64_t state;
+};
+
+// Which output changes the plans allow and how long the state being left
+// must have lasted, on the controller's clock. A first phase showing the
+// rest outputs may be cut short by the head start, so it has no minimum.
+struct Transition {
+    uint32_t from;
+    uint32_t to;
+    std::chrono::nanoseconds shortest;
+};
+
+std::vector<Transition> planTransitions() {
+    std::vector<Transition> table;
+    auto add = [&table](const PhasePlan& plan, uint32_t before) {
+        if (before != plan.outputsAt(0)) table.push_back(Transition{before, plan.outputsAt(0), 0ns});
+        for (size_t i = 0; i < plan.count; ++i) {
+            bool head_start = i == 0 && !plan.phases[0].countdown && plan.phases[0].outputs == plan.rest;
+            auto shortest = head_start ? 0ns : std::chrono::nanoseconds(plan.phases[i].duration());
+            table.push_back(Transition{plan.outputsAt(i), plan.outputsAt(i + 1), shortest});
+        }
+    };
+    add(BoardPlan::STARTUP, BoardPlan::SAFE);
+    add(BoardPlan::PEDESTRIAN, BoardPlan::PEDESTRIAN.rest);
+    return table;
+}
+
+std::chrono::nanoseconds planDuration(const PhasePlan& plan) {
+    std::chrono::nanoseconds total{0};
+    for (size_t i = 0; i < plan.count; ++i) total += plan.phases[i].duration();
+    return total;
+}
+
+std::chrono::nanoseconds longestPhase() {
+    std::chrono::nanoseconds longest{0};
+    for (const PhasePlan* plan : {&BoardPlan::STARTUP, &BoardPlan::PEDESTRIAN}) {
+        for (size_t i = 0; i < plan->count; ++i) {
+            if (plan->phases[i].duration() > longest) longest = plan->phases[i].duration();
+        }
+    }
+    return longest;
+}
+
+const std::vector<Transition> TRANSITIONS = planTransitions();
+
+// Outputs as a simulated board would hold them; every change is checked
+// against TRANSITIONS. Written only from the controller's thread(s).
+template <class Timing>
+class CheckedGpio {
+public:
+    CheckedGpio(Timing& timing, std::chrono::nanoseconds tolerance) : timing(timing), tolerance(tolerance) {}
+
+    void configure(uint32_t) {}
+
+    void write(uint32_t set_mask, uint32_t clear_mask) {
+        uint32_t next = (outputs | set_mask) & ~clear_mask;
+        auto now = timing.now();
+        if (!configured) {
+            configured = true;
+            if (next != BoardPlan::SAFE) violation("първото състояние е %#x, а не безопасното", next);
+        } else if (next != outputs) {
+            const Transition* allowed = nullptr;
+            for (const Transition& transition : TRANSITIONS) {
+                if (transition.from == outputs && transition.to == next &&
+                    (allowed == nullptr || transition.shortest < allowed->shortest)) {
+                    allowed = &transition;
+                }
+            }
+            auto held = now - std::chrono::nanoseconds(changed_at.load());
+            if (allowed == nullptr) {
+                violation("непозволен преход %#x -> %#x", outputs, next);
+            } else if (held < allowed->shortest - tolerance) {
+                violation("%#x задържано %.3f s вместо %.3f s", outputs, held.count() / 1e9,
+                          allowed->shortest.count() / 1e9);
+            }
+            transitions += 1;
+        }
+        if (next != outputs || !changed) changed_at = now.count();
+        changed = true;
+        outputs = next;
+    }
+
+    uint32_t outputs = 0;
+    uint64_t transitions = 0;
+    std::atomic<int64_t> changed_at{0};
+
+private:
+    Timing& timing;
+    std::chrono::nanoseconds tolerance;
+    bool configured = false;
+    bool changed = false;
+};
+
+struct CheckedDisplay {
+    void show(const DisplaySnapshot& snapshot) {
+        size_t phases = BoardPlan::PEDESTRIAN.count > BoardPlan::STARTUP.count ? BoardPlan::PEDESTRIAN.count
+                                                                              : BoardPlan::STARTUP.count;
+        if (snapshot.phase < -1 || snapshot.phase >= int(phases) || snapshot.seconds < -1 ||
+            snapshot.seconds > int(longestPhase() / 1s)) {
+            violation("снимка на дисплея фаза %d, %d s", snapshot.phase, snapshot.seconds);
+        }
+        shown += 1;
+    }
+
+    uint64_t shown = 0;
+};
+
+// An edge as the controller popped it, with the (scaled) time it did.
+struct Delivered {
+    std::chrono::nanoseconds timestamp;
+    std::chrono::nanoseconds popped;
+    bool rising;
+};
+
+// Lateness and press-to-sequence are checked against their bounds as they
+// are reported, and kept in real time for the summary. Popped edges are
+// kept for lostPresses() once the life is over.
+struct StressEvents : NoEvents {
+    void sequenceStarted(std::chrono::nanoseconds waited) {
+        started += 1;
+        press_to_sequence.record(uint64_t(waited.count() / SPEEDUP));
+        if (waited > wait_bound) violation("заявка чакала %.3f s", waited.count() / 1e9);
+    }
+
+    void overshoot(std::chrono::nanoseconds lateness) {
+        late.record(uint64_t(lateness.count() / SPEEDUP));
+        if (lateness > late_bound) violation("събуждане %.1f ms по-късно", lateness.count() / 1e6 / SPEEDUP);
+    }
+
+    void sequenceFinished(std::chrono::nanoseconds) {
+        finished += 1;
+    }
+
+    void traceEdge(const ButtonEdge& edge) {
+        delivered.push_back(Delivered{edge.timestamp, EventLoop::now() * SPEEDUP, edge.rising});
+    }
+
+    std::chrono::nanoseconds late_bound{0};
+    std::chrono::nanoseconds wait_bound{0};
+    uint64_t started = 0;
+    uint64_t finished = 0;
+    Histogram press_to_sequence;
+    Histogram late;
+    std::vector<Delivered> delivered;
+};
+
+// Falling edges of one burst, and whether a debouncer that saw every edge
+// sent would have taken one of them for a press.
+struct Burst {
+    std::chrono::nanoseconds first;
+    std::chrono::nanoseconds last;
+    bool press;
+};
+
+// A press is lost when none of its burst's falling edges reached the
+// controller and, when it next drained the ring, none of the edges pushed
+// meanwhile became a press in its place: the ring dropped the only press.
+// Bursts the controller never drained after (the end of a life) are not
+// judged.
+template <class Controller>
+uint64_t lostPresses(const std::vector<Burst>& bursts, const std::vector<Delivered>& delivered) {
+    Debouncer replay(Controller::BUTTON_LOCKOUT);
+    std::vector<bool> pressed(delivered.size());
+    for (size_t i = 0; i < delivered.size(); ++i) {
+        pressed[i] = replay.accept(ButtonEdge{delivered[i].timestamp, delivered[i].rising});
+    }
+    uint64_t lost = 0;
+    for (const Burst& burst : bursts) {
+        if (!burst.press) continue;
+        size_t reached = std::partition_point(delivered.begin(), delivered.end(),
+                                              [&](const Delivered& edge) { return edge.timestamp < burst.first; }) -
+                         delivered.begin();
+        size_t drained = std::partition_point(delivered.begin(), delivered.end(),
+                                              [&](const Delivered& edge) { return edge.popped <= burst.last; }) -
+                         delivered.begin();
+        if (drained == delivered.size()) continue;
+        bool served = false;
+        for (size_t i = reached; i < delivered.size() && !served; ++i) {
+            if (delivered[i].timestamp <= burst.last) {
+                served = !delivered[i].rising;
+            } else {
+                if (delivered[i].timestamp > delivered[drained].popped) break;
+                served = pressed[i];
+            }
+        }
+        if (!served) {
+            lost += 1;
+            violation("натискане в %.3f s изгубено на пълната опашка", burst.first.count() / 1e9);
+        }
+    }
+    return lost;
+}
+
+enum LifeEnd { END_LINK, END_SIGNAL, END_TIME };
+
+struct Totals {
+    uint64_t lives[3] = {0, 0, 0};
+    uint64_t cycles = 0;
+    uint64_t transitions = 0;
+    uint64_t snapshots = 0;
+    uint64_t edges = 0;
+    uint64_t dropped = 0;
+    uint64_t lost_presses = 0;
+    uint64_t presses = 0;
+    uint64_t bounces = 0;
+    uint64_t remotes = 0;
+    uint64_t flaps = 0;
+    uint64_t signals = 0;
+    uint64_t stalls = 0;
+    Histogram press_to_sequence;
+    Histogram late;
+};
+
+volatile sig_atomic_t interrupted = 0;
+std::atomic<void (*)()> stop_live{nullptr};
+
+void handle_sigint(int) {
+    interrupted = 1;
+    void (*stop)() = stop_live.load();
+    if (stop != nullptr) stop();
+}
+
+template <class Controller>
+std::atomic<Controller*> live{nullptr};
+
+template <class Controller>
+void stopLive() {
+    Controller* controller = live<Controller>.load();
+    if (controller != nullptr) controller->stop();
+}
+
+// Sleeps in short slices so a stressor notices the end of its life.
+bool pause(const std::atomic<bool>& over, std::chrono::nanoseconds gap) {
+    auto until = EventLoop::now() + gap;
+    while (!over) {
+        auto left = until - EventLoop::now();
+        if (left <= 0ns) return true;
+        std::this_thread::sleep_for(left < 10ms ? left : std::chrono::nanoseconds(10ms));
+    }
+    return false;
+}
+
+// One controller from construction to stop, with the stressors around it.
+// `signal_safe` says whether the sync policy may be stopped from the signal
+// handler (EventSync only writes an eventfd) or, as in the first two
+// programs, only from the main loop after the handler set a flag.
+template <class Sync, class Timing>
+LifeEnd life(const StressOptions& options, Random& random, std::chrono::nanoseconds deadline, bool signal_safe,
+             Totals& totals) {
+    using Scaled = ScaledTiming<Timing, SPEEDUP>;
+    using Controller = TrafficController<BoardPins, Sync, Scaled, CheckedGpio<Scaled>, CheckedDisplay, StressEvents>;
+    Scaled timing;
+    CheckedGpio<Scaled> gpio(timing, options.late_bound * SPEEDUP);
+    CheckedDisplay display;
+    Controller controller(timing, gpio, display);
+    controller.events.late_bound = options.late_bound * SPEEDUP;
+    controller.events.wait_bound =
+        planDuration(BoardPlan::PEDESTRIAN) + planDuration(BoardPlan::STARTUP) + options.late_bound * SPEEDUP;
+    controller.setup();
+
+    interrupted = 0;
+    live<Controller> = &controller;
+    if (signal_safe) stop_live = &stopLive<Controller>;
+
+    std::atomic<bool> over{false};
+    std::atomic<bool> finished{false};
+    std::atomic<uint64_t> edges{0}, remotes{0}, flaps{0}, signals{0};
+    std::vector<Burst> bursts;
+    uint64_t seeds[4];
+    for (uint64_t& seed : seeds) seed = random.next();
+
+    std::thread runner([&] {
+        controller.run();
+        finished = true;
+    });
+    std::thread button([&] {
+        Random rng(seeds[0]);
+        Debouncer shadow(Controller::BUTTON_LOCKOUT);
+        while (pause(over, rng.gap(options.bursts))) {
+            bool flood = rng.uniform() < options.floods / options.bursts;
+            int count = flood ? 1000 : 1 + int(rng.next() % uint64_t(options.max_bounces + 1));
+            Burst burst{0ns, 0ns, false};
+            for (int i = 0; i < count && !over; ++i) {
+                ButtonEdge edge{timing.now(), i % 2 == 1};
+                controller.onButtonEdge(edge);
+                if (!edge.rising) {
+                    if (i == 0) burst.first = edge.timestamp;
+                    burst.last = edge.timestamp;
+                    if (shadow.accept(edge)) burst.press = true;
+                }
+                edges.fetch_add(1, std::memory_order_relaxed);
+                if (!flood) std::this_thread::sleep_for(std::chrono::microseconds(50 + rng.next() % 450));
+            }
+            if (burst.first != 0ns) bursts.push_back(burst);
+        }
+    });
+    std::thread remote([&] {
+        Random rng(seeds[1]);
+        while (pause(over, rng.gap(options.remotes))) {
+            controller.requestWalk();
+            remotes.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    std::thread link([&] {
+        Random rng(seeds[2]);
+        while (pause(over, rng.gap(options.flaps))) {
+            controller.setLink(false);
+            flaps.fetch_add(1, std::memory_order_relaxed);
+            if (!pause(over, std::chrono::nanoseconds(int64_t(rng.uniform() * 300e6)))) break;
+            controller.setLink(true);
+        }
+    });
+    std::thread signaller([&] {
+        Random rng(seeds[3]);
+        while (pause(over, rng.gap(options.sigints))) {
+            kill(getpid(), SIGINT);
+            signals.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    // A request still pending with no output change for longer than any
+    // phase plus the lateness bound means the controller has stopped
+    // serving: a throughput collapse, counted once per episode.
+    auto stall_after = longestPhase() + 2 * options.late_bound * SPEEDUP;
+    bool stalled = false;
+    LifeEnd end = END_LINK;
+    bool stopping = false;
+    while (!finished) {
+        std::this_thread::sleep_for(1ms);
+        if (!stopping && interrupted) {
+            end = END_SIGNAL;
+            stopping = true;
+            controller.stop();
+        } else if (!stopping && EventLoop::now() >= deadline) {
+            end = END_TIME;
+            stopping = true;
+            controller.stop();
+        }
+        bool waiting = controller.working() && controller.requestPending() &&
+                       timing.now() - std::chrono::nanoseconds(gpio.changed_at.load()) > stall_after;
+        if (waiting && !stalled) {
+            totals.stalls += 1;
+            violation("заявка без обслужване от %.1f s", (timing.now().count() - gpio.changed_at.load()) / 1e9);
+        }
+        stalled = waiting;
+    }
+    runner.join();
+    over = true;
+    button.join();
+    remote.join();
+    link.join();
+    signaller.join();
+    stop_live = nullptr;
+    live<Controller> = nullptr;
+    if (end == END_LINK && interrupted) end = END_SIGNAL;
+
+    const StressEvents& events = controller.events;
+    if (end == END_LINK && (events.started != events.finished || gpio.outputs != BoardPlan::PEDESTRIAN.rest)) {
+        violation("загубата на връзка прекъсна започнат цикъл (изходи %#x)", gpio.outputs);
+    }
+    if (controller.working()) violation("run() върна, а контролерът още работи");
+
+    totals.lives[end] += 1;
+    totals.cycles += events.finished;
+    totals.transitions += gpio.transitions;
+    totals.snapshots += display.shown;
+    totals.edges += edges;
+    totals.dropped += controller.droppedEdges();
+    totals.presses += controller.debouncer.accepted;
+    totals.lost_presses += lostPresses<Controller>(bursts, events.delivered);
+    totals.bounces += controller.debouncer.rejected;
+    totals.remotes += remotes;
+    totals.flaps += flaps;
+    totals.signals += signals;
+    totals.press_to_sequence.merge(events.press_to_sequence);
+    totals.late.merge(events.late);
+    return end;
+}
+
+template <class Sync, class Timing>
+void soak(const char* name, const StressOptions& options, bool signal_safe) {
+    Random random(options.seed);
+    Totals totals;
+    uint64_t before = violations;
+    auto start = EventLoop::now();
+    auto deadline = start + std::chrono::nanoseconds(int64_t(options.hours * 3600e9));
+    while (EventLoop::now() < deadline) life<Sync, Timing>(options, random, deadline, signal_safe, totals);
+    double seconds = (EventLoop::now() - start).count() / 1e9;
+
+    printf("%s: %.0f s, %llu живота (връзка %llu, SIGINT %llu, време %llu), нарушения %llu\n", name, seconds,
+           (unsigned long long)(totals.lives[END_LINK] + totals.lives[END_SIGNAL] + totals.lives[END_TIME]),
+           (unsigned long long)totals.lives[END_LINK], (unsigned long long)totals.lives[END_SIGNAL],
+           (unsigned long long)totals.lives[END_TIME], (unsigned long long)(violations - before));
+    printf("  %llu цикъла (%.1f/s), %llu прехода, %llu снимки, %llu заявки отвън, %llu прекъсвания на връзката, "
+           "%llu SIGINT\n",
+           (unsigned long long)totals.cycles, totals.cycles / seconds, (unsigned long long)totals.transitions,
+           (unsigned long long)totals.snapshots, (unsigned long long)totals.remotes, (unsigned long long)totals.flaps,
+           (unsigned long long)totals.signals);
+    printf("  фронтове: %llu изпратени, %llu изгубени (%llu натискания изцяло), %llu натискания, %llu отскока\n",
+           (unsigned long long)totals.edges, (unsigned long long)totals.dropped,
+           (unsigned long long)totals.lost_presses, (unsigned long long)totals.presses,
+           (unsigned long long)totals.bounces);
+    printf("  закъснение p99 %.1f us, max %.1f us; натиск -> цикъл p99 %.1f ms, max %.1f ms; застои %llu\n",
+           totals.late.percentile(99) / 1000.0, totals.late.maximum() / 1000.0,
+           totals.press_to_sequence.percentile(99) / 1e6, totals.press_to_sequence.maximum() / 1e6,
+           (unsigned long long)totals.stalls);
+}
+
+int usage(const char* program) {
+    printf("Употреба: %s [--hours H] [--sync all|condvar|pthread|event] [--bursts N] [--bounces N] "
+           "[--floods N] [--remote N] [--flaps N] [--sigints N] [--late-ms MS] [--seed N]\n",
+           program);
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    StressOptions options;
+    const char* sync = "all";
+    for (int i = 1; i < argc; i += 2) {
+        if (std::strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        }
+        if (i + 1 == argc) {
+            printf("Опцията %s няма стойност\n", argv[i]);
+            return usage(argv[0]);
+        }
+        if (std::strcmp(argv[i], "--hours") == 0) {
+            options.hours = std::atof(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--sync") == 0) {
+            sync = argv[i + 1];
+            if (std::strcmp(sync, "all") != 0 && std::strcmp(sync, "condvar") != 0 &&
+                std::strcmp(sync, "pthread") != 0 && std::strcmp(sync, "event") != 0) {
+                printf("Непозната синхронизация %s\n", sync);
+                return usage(argv[0]);
+            }
+        } else if (std::strcmp(argv[i], "--bursts") == 0) {
+            options.bursts = std::atof(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--bounces") == 0) {
+            options.max_bounces = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--floods") == 0) {
+            options.floods = std::atof(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--remote") == 0) {
+            options.remotes = std::atof(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--flaps") == 0) {
+            options.flaps = std::atof(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--sigints") == 0) {
+            options.sigints = std::atof(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--late-ms") == 0) {
+            options.late_bound = std::chrono::nanoseconds(int64_t(std::atof(argv[i + 1]) * 1e6));
+        } else if (std::strcmp(argv[i], "--seed") == 0) {
+            options.seed = std::strtoull(argv[i + 1], nullptr, 10);
+        } else {
+            printf("Непозната опция %s\n", argv[i]);
+            return usage(argv[0]);
+        }
+    }
+    if (options.bursts <= 0) options.bursts = 1;
+    if (options.max_bounces < 0) options.max_bounces = 0;
+    signal(SIGINT, handle_sigint);
+
+    printf("Натоварване x%d, %.2f h на стратегия, пакети %.1f/s до %d отскока, наводнения %.2f/s, "
+           "заявки %.1f/s, връзка %.2f/s, SIGINT %.3f/s\n",
+           SPEEDUP, options.hours, options.bursts, options.max_bounces, options.floods, options.remotes,
+           options.flaps, options.sigints);
+    bool all = std::strcmp(sync, "all") == 0;
+    if (all || std::strcmp(sync, "condvar") == 0) {
+        soak<CondVarSync, SteadyTiming>("condition_variable + sleep_until", options, false);
+    }
+    if (all || std::strcmp(sync, "pthread") == 0) {
+        soak<PthreadSync, NanosleepTiming>("pthread + clock_nanosleep", options, false);
+    }
+    if (all || std::strcmp(sync, "event") == 0) {
+        soak<EventSync, EventLoopTiming>("timerfd + eventfd", options, true);
+    }
+    printf("Нарушения общо: %llu\n", (unsigned long long)violations.load());
+    return violations == 0 ? 0 : 1;
+}
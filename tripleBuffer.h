@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Hands the latest value from one writer to one reader. The writer fills its
+// own slot and swaps it with the shared one, so publish() never waits; the
+// reader swaps the shared slot for its own only when something new arrived.
+// Values published faster than the reader takes them are overwritten.
+template <class T>
+class TripleBuffer {
+public:
+    void publish(const T& value) {
+        slots[back] = value;
+        back = shared.exchange(uint8_t(back | FRESH), std::memory_order_acq_rel) & INDEX;
+        published.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool take(T& value) {
+        if ((shared.load(std::memory_order_relaxed) & FRESH) == 0) return false;
+        front = shared.exchange(front, std::memory_order_acq_rel) & INDEX;
+        value = slots[front];
+        taken.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    uint64_t publishedCount() const {
+        return published.load(std::memory_order_relaxed);
+    }
+
+    uint64_t takenCount() const {
+        return taken.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr uint8_t INDEX = 0x3;
+    static constexpr uint8_t FRESH = 0x4;
+
+    T slots[3] = {};
+    uint8_t back = 0;
+    uint8_t front = 1;
+    alignas(64) std::atomic<uint8_t> shared{2};
+    alignas(64) std::atomic<uint64_t> published{0};
+    alignas(64) std::atomic<uint64_t> taken{0};
+};